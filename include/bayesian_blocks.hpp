@@ -22,12 +22,28 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
-#include <map>
 #include <algorithm>
 #include <numeric>
 #include <stdexcept>
 #include <cassert>
 #include <limits>
+#include <memory>
+#include <type_traits>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <iterator>
+#if defined(__unix__) || defined(__APPLE__)
+#define BAYESIAN_BLOCKS_RUSAGE
+#include <sys/resource.h>
+#endif
+
+#include "bayesian_blocks_config.hpp"
+#include "bayesian_blocks_simd.hpp"
+#include "bayesian_blocks_fitness.hpp"
+#include "bayesian_blocks_threads.hpp"
+#include "bayesian_blocks_cache.hpp"
+#include "bayesian_blocks_sort.hpp"
 
 #ifndef _BAYESIAN_BLOCKS_HH
 #define _BAYESIAN_BLOCKS_HH
@@ -46,143 +62,1482 @@ namespace BayesianBlocks {
         using clock = std::chrono::high_resolution_clock;
         using std::chrono::duration_cast;
         using us = std::chrono::microseconds;
+
+        // counters filled by blocks()
+        struct stats {
+            std::size_t candidates = 0; // fitness evaluations
+            std::size_t survivors  = 0; // candidate change points alive at the end
+            std::size_t peak       = 0; // maximum number of alive candidates
+            double objective       = 0; // fitness of the partition found, prior included
+            // exact objective minus the one of the approximate modes, if
+            // options::exact_gap is set, NaN otherwise
+            double gap = std::numeric_limits<double>::quiet_NaN();
+            // with options::segments and neither grid nor max_block, whether
+            // every boundary converged within its segment, with no serial
+            // stitching into the following ones. Convergence means that the
+            // alive candidates agree up to a relative tolerance of 1e-9, a
+            // strong check but not a proof that the result is the exact one
+            bool certified = false;
+        };
+
+        // peak resident set size of the process in bytes, 0 if unknown
+        inline std::size_t peak_rss() {
+#ifdef BAYESIAN_BLOCKS_RUSAGE
+            rusage usage;
+            if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+            return static_cast<std::size_t>(usage.ru_maxrss); // bytes on macOS
+#else
+            return static_cast<std::size_t>(usage.ru_maxrss) * 1024; // KiB elsewhere
+#endif
+#else
+            return 0;
+#endif
+        }
+
+        // steps of a call, in order. The binned mode has no sorting
+        enum class phase { sort, edges, loop, backtrack };
+
+        // thrown when a computation is stopped by its observer
+        class cancelled : public std::runtime_error {
+            public:
+            explicit cancelled(const std::string& what) : std::runtime_error(what) {}
+        };
+
+        // Instrumentation of blocks() and friends, attached through
+        // options::observer. Hooks are called from the calling thread: phase
+        // timings at the end of each phase, progress and checks of the
+        // cancellation flag and of the time budget every progress_interval
+        // steps of the recursion. Without an observer nothing is measured
+        class observer {
+            public:
+            virtual ~observer() {}
+
+            virtual void on_phase(phase, double /*seconds*/) {}
+            virtual void on_progress(std::size_t /*step*/, std::size_t /*steps*/) {}
+            // counters of the recursion, at the end of the loop
+            virtual void on_report(const stats&) {}
+
+            // stop the running computation at the next check, from any thread
+            void cancel() { stop = true; }
+            bool cancelled() const { return stop; }
+
+            // called at the start of each call, resets the cancellation flag
+            void begin() {
+                stop = false;
+                start = clock::now();
+            }
+
+            // throws bb::cancelled if the computation must stop
+            void check(std::size_t step, std::size_t steps) {
+                this->on_progress(step, steps);
+                if (stop) throw bb::cancelled("ERROR: computation cancelled");
+                if (budget > 0 and
+                    std::chrono::duration<double>(clock::now() - start).count() > budget) {
+                    throw bb::cancelled("ERROR: time budget exceeded");
+                }
+            }
+
+            // progress_interval, never 0
+            std::size_t interval() const { return progress_interval != 0 ? progress_interval : 1; }
+
+            // steps between two checks, 0 is taken as 1 (a check at each step)
+            std::size_t progress_interval = 4096;
+            // maximum wall-clock time of a call in seconds, 0 means no limit
+            double budget = 0;
+
+            private:
+            std::atomic<bool> stop{false};
+            clock::time_point start = clock::now();
+        };
+
+        // the progress counter and the timings of the legacy counter and
+        // benchmark flags, printed to std::cout. The hooks are forwarded to
+        // next, if not null, which can still stop the call with its
+        // cancellation flag or time budget
+        class stream_observer : public observer {
+            public:
+            stream_observer(bool counter, bool benchmark, observer* next = nullptr) :
+                counter(counter), benchmark(benchmark), next(next) {
+                if (next) {
+                    next->begin();
+                    progress_interval = next->progress_interval;
+                }
+            }
+
+            void on_phase(phase p, double seconds) override {
+                if (next) next->on_phase(p, seconds);
+                if (counter and p == phase::loop) std::cout << std::endl;
+                if (!benchmark) return;
+                static const char* names[] = { "sort", "edges", "loop", "backtrack" };
+                std::cout << names[static_cast<int>(p)] << ": ";
+                seconds > 1E-3 ?
+                    std::cout << seconds*1E3 << " ms" :
+                    std::cout << seconds*1E6 << " us";
+                std::cout << std::endl;
+                if (p == phase::backtrack and peak_rss() > 0) {
+                    std::cout << "peak RSS: " << peak_rss()/1048576. << " MiB" << std::endl;
+                }
+            }
+
+            void on_progress(std::size_t step, std::size_t steps) override {
+                if (counter) std::cout << '\r' << step << '/' << steps << std::flush;
+                if (next) next->check(step, steps);
+            }
+
+            void on_report(const stats& report) override {
+                if (next) next->on_report(report);
+                if (!benchmark) return;
+                std::cout << "candidates: " << report.candidates
+                          << " (alive: " << report.survivors << ", peak: " << report.peak << ")"
+                          << std::endl;
+            }
+
+            private:
+            bool counter, benchmark;
+            observer* next;
+        };
+
+        // tuning of the algorithm
+        struct options {
+            // instruction set of the fitness kernel, the widest one supported
+            // by the CPU is picked at runtime by default
+            simd kernel = simd::automatic;
+            // drop candidate change points that can never be optimal again
+            // (Killick et al. 2012), same result. About linear time when the
+            // number of change points grows with the data; on flat data few
+            // candidates are dropped and the time stays quadratic
+            bool pruned = false;
+            // number of threads sharing the evaluation of the candidates at
+            // each step, 0 means one per hardware thread
+            unsigned threads = 1;
+            // minimum number of candidates for a step to be split among the
+            // threads, smaller steps are not worth the synchronization
+            std::size_t parallel_threshold = 16384;
+            // the caller guarantees that the data is sorted, skip the sort
+            bool presorted = false;
+            // approximate modes, faster but not optimal in general. Blocks of
+            // at most max_block cells (distinct values or bins), O(N max_block)
+            std::size_t max_block = 0;
+            // change points only among about grid edges, at quantiles of the
+            // cumulative weights, O(grid^2). Not used by Engine and blocks_mmap
+            std::size_t grid = 0;
+            // in the approximate modes, run the exact recursion too and fill
+            // stats::gap. As expensive as the exact mode
+            bool exact_gap = false;
+            // split the cells into that many contiguous segments, solved on
+            // the threads of options::threads, then stitched at the
+            // boundaries. The recursion is pruned. See stats::certified for
+            // how close the result is to the exact one. Not used by Engine
+            // and blocks_mmap
+            std::size_t segments = 0;
+            // if not null, filled with the counters of the last call
+            stats* report = nullptr;
+            // if not null, results are looked up here before running the
+            // recursion and stored afterwards
+            edge_cache* cache = nullptr;
+            // if not null, receives timings and progress and may stop the call
+            bb::observer* observer = nullptr;
+        };
+
+        // working memory of blocks(), reused between calls
+        template <typename T = double> class workspace;
     }
 
-    // core utility
+    // core utility, for floating point data (float, double) and arithmetic
+    // weights (integer counts or fractional weights)
+    template <typename T, typename W>
+    std::vector<T> blocks(std::vector<T> data, std::vector<W> weights, const double p,
+                          const bb::options& opts, bool counter = false, bool benchmark = false);
+
+    template <typename T, typename W>
+    std::vector<T> blocks(std::vector<T> data, std::vector<W> weights, const double p = 0.01,
+                          bool counter = false, bool benchmark = false);
+
+    template <typename T>
+    std::vector<T> blocks(std::vector<T> data, const double p,
+                          const bb::options& opts, bool counter = false, bool benchmark = false);
+
+    template <typename T>
+    std::vector<T> blocks(std::vector<T> data, const double p = 0.01,
+                          bool counter = false, bool benchmark = false);
+
+    // Zero-copy interface: values in [first, last), e.g. a pointer range over
+    // a caller's buffer, weights (if given) from w_first on. The working
+    // memory and the result live in ws: once it has grown to the size of the
+    // input, calls with opts.threads = 1 do no heap allocation. The returned
+    // array is owned by ws and valid until its next use
+    template <typename It, typename T>
+    const std::vector<T>& blocks(It first, It last, const double p, bb::workspace<T>& ws,
+                                 const bb::options& opts = bb::options());
+
+    template <typename It, typename WIt, typename T>
+    const std::vector<T>& blocks(It first, It last, WIt w_first, const double p,
+                                 bb::workspace<T>& ws, const bb::options& opts = bb::options());
+
+    // Values split into chunks, e.g. filled by several reader threads: the
+    // chunks are sorted on opts.threads threads and merged, with no sort of
+    // the whole input. They are moved into ws and cleared
+    template <typename T>
+    const std::vector<T>& blocks_chunks(std::vector<std::vector<T>>& chunks, const double p,
+                                        bb::workspace<T>& ws, const bb::options& opts = bb::options());
+
+    template <typename T>
+    std::vector<T> blocks_chunks(std::vector<std::vector<T>> chunks, const double p = 0.01,
+                                 const bb::options& opts = bb::options());
+
+    // Prior scan: the change points for each false positive rate in ps, in
+    // the same order, equal to those of separate blocks() calls. Sorting and
+    // edges are done once, and so is the fitness of each candidate block in
+    // the exhaustive mode. The priors are spread over opts.threads threads
+    template <typename T, typename W>
+    std::vector<std::vector<T>> blocks_scan(std::vector<T> data, std::vector<W> weights,
+                                            const std::vector<double>& ps,
+                                            const bb::options& opts = bb::options());
+
+    template <typename T>
+    std::vector<std::vector<T>> blocks_scan(std::vector<T> data, const std::vector<double>& ps,
+                                            const bb::options& opts = bb::options());
+
+    // binned data: counts[i] is the content of the bin [edges[i], edges[i+1]),
+    // the change points are chosen among the bin edges
+    template <typename T, typename W>
+    std::vector<T> blocks_binned(const std::vector<T>& edges, const std::vector<W>& counts,
+                                 const double p, const bb::options& opts,
+                                 bool counter = false, bool benchmark = false);
+
+    template <typename T, typename W>
+    std::vector<T> blocks_binned(const std::vector<T>& edges, const std::vector<W>& counts,
+                                 const double p = 0.01, bool counter = false, bool benchmark = false);
+
+    // Point measurements: values y with Gaussian errors sigma at positions x
+    // (e.g. the times of a slow-control series), with the fitness and prior
+    // of fitness::measurements. Measurements at the same position are combined
+    template <typename T>
+    std::vector<T> blocks_measurements(std::vector<T> x, const std::vector<T>& y,
+                                       const std::vector<T>& sigma, const double p = 0.01,
+                                       const bb::options& opts = bb::options());
+
+    // double data and integer weights
+    bb::array blocks(bb::data_array data, bb::weights_array weights, const double p,
+                     const bb::options& opts, bool counter = false, bool benchmark = false);
+
     bb::array blocks(bb::data_array data, bb::weights_array weights, const double p = 0.01,
                      bool counter = false, bool benchmark = false);
 
+    bb::array blocks(bb::data_array data, const double p,
+                     const bb::options& opts, bool counter = false, bool benchmark = false);
+
     bb::array blocks(bb::data_array data, const double p = 0.01,
                      bool counter = false, bool benchmark = false);
 }
 
 namespace BayesianBlocks {
 
+    namespace detail {
+
+        // measures consecutive phases for the observer, if any
+        class phase_timer {
+            public:
+            explicit phase_timer(bb::observer* obs) : obs(obs) {
+                if (obs) start = bb::clock::now();
+            }
+
+            void done(bb::phase p) {
+                if (!obs) return;
+                const auto now = bb::clock::now();
+                obs->on_phase(p, std::chrono::duration<double>(now - start).count());
+                start = now;
+            }
+
+            private:
+            bb::observer* obs;
+            bb::clock::time_point start;
+        };
+
+        // calibrated prior on the number of change points for N event data
+        // (Scargle et al. 2012, eq. 21), with the sign of a fitness term
+        inline double ncp_prior(const double p, std::size_t N) {
+            return fitness::events::ncp_prior(p, N);
+        }
+
+        // Run the kernel over [0, n) with the range split among the threads of
+        // the pool. Chunk boundaries are multiples of the widest vector length,
+        // so that every candidate goes through the same code path (vector body
+        // or scalar remainder) as in a serial call: the result is the same bit
+        // for bit
+        template <typename T>
+        inline argmax_t parallel_argmax(thread_pool& pool, std::vector<argmax_t>& partial,
+                                        argmax_kernel<T> kernel, const double* W, const T* E,
+                                        const double* B, std::size_t n, double W_k, double E_k,
+                                        double ncp_prior, double* A) {
+            const std::size_t n_threads = pool.size();
+            const std::size_t chunk = ((n + n_threads - 1)/n_threads + 7)/8 * 8;
+
+            auto task = [&](unsigned i) {
+                const auto begin = std::min(n, i*chunk);
+                const auto end   = std::min(n, begin + chunk);
+                if (begin == end) {
+                    partial[i] = { -std::numeric_limits<double>::infinity(), 0 };
+                    return;
+                }
+                partial[i] = kernel(W + begin, E + begin, B + begin, end - begin,
+                                    W_k, E_k, ncp_prior, A ? A + begin : nullptr);
+                partial[i].pos += begin;
+            };
+            pool.run(task);
+
+            // merge in index order, keeping the first maximum
+            auto res = partial[0];
+            for (std::size_t i = 1; i < n_threads; ++i) {
+                if (partial[i].value > res.value) res = partial[i];
+            }
+            return res;
+        }
+
+        // The optimal partitioning recursion
+        //
+        //   best[k+1] = max_r { fitness(r..k) + ncp_prior + best[r] },  last[k] = argmax
+        //
+        // over the two cumulative arrays W and E of the fitness policy F (for
+        // event data the weights and the edges). best is shifted by one,
+        // best[0] = 0 is the fitness of the empty partition. Steps only depend
+        // on earlier ones, so the recursion can be extended as data arrives.
+        // last and best can be stored in any container with the push_back,
+        // reserve, data, size and subscript interface of std::vector
+        template <typename T, typename F = fitness::events,
+                  typename Last = std::vector<std::size_t>, typename Best = bb::array>
+        class solver {
+
+            public:
+
+            solver(const bb::options& opts, double ncp_prior, Last last = Last(), Best best = Best()) :
+                last(std::move(last)),
+                best(std::move(best)),
+                opts(opts),
+                ncp_prior(ncp_prior),
+                kernel(select_kernel<F, T>(opts.kernel)) {
+                this->best.push_back(0.);
+            }
+
+            // start over with new options and prior, keeping the memory
+            // allocated so far (and the thread pool, if of the same size)
+            void reset(const bb::options& o, double prior) {
+                opts      = o;
+                ncp_prior = prior;
+                kernel    = select_kernel<F, T>(o.kernel);
+                if (pool and pool->size() != this->n_threads()) pool.reset();
+                last.clear();
+                best.clear();
+                best.push_back(0.);
+                report = bb::stats();
+                live_r.clear();
+                live_W.clear();
+                live_E.clear();
+                live_B.clear();
+            }
+
+            // number of steps done so far
+            std::size_t size() const { return last.size(); }
+
+            // run the recursion up to step k_end (excluded), W and E must hold
+            // at least k_end+1 entries
+            void advance(const double* W, const T* E, std::size_t k_end) {
+                const auto n_threads = this->n_threads();
+                if (!pool and n_threads > 1 and k_end > opts.parallel_threshold) {
+                    pool.reset(new thread_pool(n_threads));
+                    partial.resize(n_threads);
+                }
+
+                last.reserve(k_end);
+                best.reserve(k_end+1);
+
+                for (auto k = this->size(); k < k_end; ++k) {
+                    const auto max = this->step(W, E, k, true);
+                    last.push_back(max.pos);
+                    best.push_back(max.value);
+
+                    if (opts.observer and k % opts.observer->interval() == 0) {
+                        opts.observer->check(k, k_end);
+                    }
+                }
+                report.survivors = opts.pruned ? live_r.size() : this->size();
+                report.objective = best[best.size()-1];
+            }
+
+            // evaluate step size() without recording it
+            argmax_t peek(const double* W, const T* E) {
+                return this->step(W, E, this->size(), false);
+            }
+
+            // continue from the state of o, run on the same arrays. The
+            // report only counts the steps done from here on
+            void resume(const solver& o) {
+                last   = o.last;
+                best   = o.best;
+                report = bb::stats();
+                live_r = o.live_r;
+                live_W = o.live_W;
+                live_E = o.live_E;
+                live_B = o.live_B;
+            }
+
+            // pruned mode: whether the next steps are the ones of o, run on the
+            // arrays shifted by shift cells. That is, the alive candidates are
+            // the same and their best fitness (and the one of the next
+            // candidate) differ by a constant, written to offset
+            bool coalesced(const solver& o, std::size_t shift, double& offset) const {
+                if (live_r.size() != o.live_r.size() or size() != o.size() + shift) return false;
+                offset = best[size()] - o.best[o.size()];
+                auto same = [offset](double a, double b) {
+                    return std::abs(a - b - offset) <= 1E-9 * (std::abs(a) + std::abs(b));
+                };
+                if (!same(best[size()], o.best[o.size()])) return false;
+                for (std::size_t i = 0; i < live_r.size(); ++i) {
+                    if (live_r[i] != o.live_r[i] + shift or !same(live_B[i], o.live_B[i])) return false;
+                }
+                return true;
+            }
+
+            // pruned mode: the alive candidates, sorted
+            const std::vector<std::size_t>& alive() const { return live_r; }
+
+            // pruned mode: drop the steps before c, so that cell c is the first
+            // one. Candidates before c are dropped too, W_c (the cumulative
+            // weight at c) and best[c] are subtracted from the stored values.
+            // If every alive candidate is c or later, the next steps are the
+            // ones of the recursion on the whole arrays. Last must be a vector
+            void rebase(std::size_t c, double W_c) {
+                const auto B_c = best[c];
+                last.erase(last.begin(), last.begin() + c);
+                // steps whose last block starts before c can not be reached
+                // anymore by backtracking, they point to the new first cell
+                for (auto& l : last) l = l < c ? 0 : l - c;
+                best.erase(best.begin(), best.begin() + c);
+                for (auto& b : best) b -= B_c;
+                std::size_t j = 0;
+                for (std::size_t i = 0; i < live_r.size(); ++i) {
+                    if (live_r[i] < c) continue;
+                    live_r[j] = live_r[i] - c;
+                    live_W[j] = live_W[i] - W_c;
+                    live_E[j] = live_E[i];
+                    live_B[j] = live_B[i] - B_c;
+                    ++j;
+                }
+                live_r.resize(j);
+                live_W.resize(j);
+                live_E.resize(j);
+                live_B.resize(j);
+            }
+
+            Last last;
+            Best best;
+            bb::stats report;
+
+            private:
+
+            unsigned n_threads() const {
+                return pool_size(opts.threads);
+            }
+
+            argmax_t step(const double* W, const T* E, std::size_t k, bool commit) {
+                // blocks of at most max_block cells: candidates from lo on
+                const auto lo = opts.max_block > 0 and k+1 > opts.max_block ? k+1 - opts.max_block : 0;
+
+                if (!opts.pruned or !F::prunable) {
+                    if (commit) {
+                        report.candidates += k+1 - lo;
+                        report.peak = std::max(report.peak, k+1 - lo);
+                    }
+                    auto max = this->argmax(W + lo, E + lo, best.data() + lo, k+1 - lo,
+                                            W[k+1], E[k+1], nullptr);
+                    max.pos += lo;
+                    return max;
+                }
+
+                // The fitness is superadditive: splitting a block never lowers
+                // it. Hence if best[r] + fitness(r..k) < best[k+1], i.e. the
+                // candidate trails by more than one change point penalty, r will
+                // lose against k+1 at every later step and can be dropped. Alive
+                // candidates are kept sorted and compacted, so that the kernel runs
+                // on contiguous arrays and returns the same first maximum
+                live_r.push_back(k);
+                live_W.push_back(W[k]);
+                live_E.push_back(E[k]);
+                live_B.push_back(best[k]);
+
+                const auto n = live_r.size();
+                if (A.size() < n) A.resize(std::max(n, 2*A.size()));
+                auto max = this->argmax(live_W.data(), live_E.data(), live_B.data(), n,
+                                        W[k+1], E[k+1], A.data());
+                max.pos = live_r[max.pos];
+
+                if (!commit) {
+                    live_r.pop_back();
+                    live_W.pop_back();
+                    live_E.pop_back();
+                    live_B.pop_back();
+                    return max;
+                }
+
+                report.candidates += n;
+                report.peak = std::max(report.peak, n);
+
+                // small safety margin against rounding in the fitness values.
+                // Candidates too far back for the next step go too
+                const auto threshold = max.value + ncp_prior
+                                       - 1E-9 * (std::abs(max.value) + std::abs(ncp_prior));
+                const auto next_lo = opts.max_block > 0 and k+2 > opts.max_block ? k+2 - opts.max_block : 0;
+                std::size_t j = 0;
+                for (std::size_t i = 0; i < n; ++i) {
+                    if (A[i] < threshold or live_r[i] < next_lo) continue;
+                    live_r[j] = live_r[i];
+                    live_W[j] = live_W[i];
+                    live_E[j] = live_E[i];
+                    live_B[j] = live_B[i];
+                    ++j;
+                }
+                live_r.resize(j);
+                live_W.resize(j);
+                live_E.resize(j);
+                live_B.resize(j);
+
+                return max;
+            }
+
+            // the same kernel, with large steps split among threads
+            argmax_t argmax(const double* W, const T* E, const double* B, std::size_t n,
+                            double W_k, double E_k, double* A) {
+                if (!pool or n < opts.parallel_threshold) {
+                    return kernel(W, E, B, n, W_k, E_k, ncp_prior, A);
+                }
+                return parallel_argmax(*pool, partial, kernel, W, E, B, n,
+                                       W_k, E_k, ncp_prior, A);
+            }
+
+            bb::options opts;
+            double ncp_prior;
+            argmax_kernel<T> kernel;
+            std::unique_ptr<thread_pool> pool;
+            std::vector<argmax_t> partial;
+
+            // alive candidates of the pruned mode
+            std::vector<std::size_t> live_r;
+            std::vector<T> live_E;
+            bb::array live_W, live_B, A;
+        };
+
+        // indices of about m edges at quantiles of the cumulative weights,
+        // first and last included, and the edges and weights there. Empty if
+        // m is 0 or not smaller than N
+        template <typename T>
+        void make_grid(const T* edges, const double* cumw, std::size_t N, std::size_t m,
+                       std::vector<std::size_t>& grid, std::vector<T>& grid_E, bb::array& grid_W) {
+            if (m == 0 or m >= N) return;
+            grid.push_back(0);
+            for (std::size_t i = 1; i < m; ++i) {
+                const auto q = cumw[0] + (cumw[N] - cumw[0]) * i / m;
+                const std::size_t g = std::lower_bound(cumw, cumw + N, q) - cumw;
+                if (g > grid.back()) grid.push_back(g);
+            }
+            grid.push_back(N);
+            for (auto g : grid) {
+                grid_E.push_back(edges[g]);
+                grid_W.push_back(cumw[g]);
+            }
+        }
+
+        // Segment-parallel recursion over the n cells of W and E: the cells are
+        // split into contiguous segments, spread over opts.threads threads,
+        // each one solved as if it started the data. The recursion around boundary i is then
+        // run again from the state at the end of segment i-1, step by step
+        // (a growing window) along with a replay of segment i, until both have
+        // the same alive candidates up to a constant in the best fitness: from
+        // there on they take the same decisions, and the rest of segment i is
+        // already known. The stitches of all the boundaries run in parallel;
+        // one that does not converge within its segment goes on serially
+        // into the following ones. If every one converges within its segment
+        // report.certified is set; convergence is tested up to a floating
+        // point tolerance, so this is a strong check but not a proof. Writes
+        // the last array of the whole recursion
+        template <typename T, typename F>
+        void segmented(const double* W, const T* E, std::size_t n, double ncp_prior,
+                       const bb::options& opts, std::vector<std::size_t>& last, bb::stats& report) {
+
+            const auto S = std::min(opts.segments, n);
+            std::vector<std::size_t> bounds(S+1);
+            for (std::size_t i = 0; i <= S; ++i) bounds[i] = n * i / S;
+
+            auto o = opts;
+            o.pruned   = true;
+            o.threads  = 1;
+            o.observer = nullptr;
+            std::vector<solver<T, F>> seg, stitch;
+            seg.reserve(S);
+            stitch.reserve(S);
+            for (std::size_t i = 0; i < S; ++i) {
+                seg.emplace_back(o, ncp_prior);
+                stitch.emplace_back(o, ncp_prior);
+            }
+            // each thread takes the next segment not done yet
+            const auto n_threads = pool_size(opts.threads);
+            thread_pool pool(static_cast<unsigned>(std::min<std::size_t>(n_threads, S)));
+            std::atomic<std::size_t> next(0);
+
+            auto solve = [&](unsigned) {
+                for (auto i = next++; i < S; i = next++) {
+                    seg[i].advance(W + bounds[i], E + bounds[i], bounds[i+1] - bounds[i]);
+                }
+            };
+            pool.run(solve);
+            if (opts.observer) opts.observer->check(n/2, n);
+
+            // stitch[i] runs on the arrays of segment i-1, up to end[i]
+            std::vector<std::size_t> end(S, 0);
+            std::vector<double> offset(S, 0.);
+            std::vector<char> converged(S, 1);
+            auto stitch_at = [&](std::size_t i) {
+                const auto a = bounds[i-1], b = bounds[i];
+                auto& st = stitch[i];
+                st.resume(seg[i-1]);
+                solver<T, F> replay(o, ncp_prior);
+                // advanced one step at a time, grow the arrays once
+                st.last.reserve(bounds[i+1] - a);
+                st.best.reserve(bounds[i+1] - a + 1);
+                replay.last.reserve(bounds[i+1] - b);
+                replay.best.reserve(bounds[i+1] - b + 1);
+                converged[i] = 0;
+                for (end[i] = b; end[i] < bounds[i+1] and !converged[i]; ++end[i]) {
+                    st.advance(W + a, E + a, end[i]+1 - a);
+                    replay.advance(W + b, E + b, end[i]+1 - b);
+                    converged[i] = st.coalesced(replay, b - a, offset[i]);
+                }
+                st.report.candidates += replay.report.candidates;
+            };
+            next = 1;
+            auto join = [&](unsigned) {
+                for (auto i = next++; i < S; i = next++) stitch_at(i);
+            };
+            pool.run(join);
+
+            // the stitched steps, then the ones of the segments, with global
+            // indices. A boundary that did not converge within its segment
+            // goes on, serially, into the following ones, each replayed from
+            // its start, until it converges: the state at the end of that
+            // segment is then the one of the whole recursion, and so is the
+            // stitch of the next boundary. If it never does, the stitch runs
+            // to the end, as the serial recursion
+            last.resize(n);
+            report = bb::stats();
+            report.certified = true;
+            for (std::size_t k = 0; k < bounds[1]; ++k) last[k] = seg[0].last[k];
+            report.survivors = seg[S-1].report.survivors;
+            for (std::size_t i = 1; i < S; ) {
+                const auto a = bounds[i-1];
+                auto& st = stitch[i];
+                auto k = bounds[i];
+                for (; k < end[i]; ++k) last[k] = st.last[k - a] + a;
+                bool done = converged[i];
+                report.certified = report.certified and done;
+                auto j = i;
+                while (!done and ++j < S) {
+                    if (opts.observer) opts.observer->check(bounds[j], n);
+                    const auto b = bounds[j];
+                    solver<T, F> replay(o, ncp_prior);
+                    for (; k < bounds[j+1] and !done; ++k) {
+                        st.advance(W + a, E + a, k+1 - a);
+                        replay.advance(W + b, E + b, k+1 - b);
+                        done = st.coalesced(replay, b - a, offset[j]);
+                        last[k] = st.last[k - a] + a;
+                    }
+                    report.candidates += replay.report.candidates;
+                }
+                if (!done) {
+                    report.survivors = st.report.survivors;
+                    break;
+                }
+                const auto b = bounds[j];
+                for (; k < bounds[j+1]; ++k) last[k] = seg[j].last[k - b] + b;
+                i = j+1;
+            }
+            for (std::size_t i = 0; i < S; ++i) {
+                report.candidates += seg[i].report.candidates + stitch[i].report.candidates;
+                report.peak = std::max(report.peak, std::max(seg[i].report.peak, stitch[i].report.peak));
+            }
+
+            // fitness of the partition found
+            for (auto k = n; k != 0; k = last[k-1]) {
+                const auto r = last[k-1];
+                report.objective += F::value(W[k] - W[r], E[k] - static_cast<double>(E[r])) + ncp_prior;
+            }
+            if (opts.observer) opts.observer->check(n, n);
+        }
+
+        // Optimal partition of the N cells [edges[i], edges[i+1]) holding
+        // cumw[i+1] - cumw[i] counts. The indices in edges of the change
+        // points, first and last edge included, are written to cp. dp is
+        // reset and run, its memory is reused. Other fitness policies take
+        // their own cumulative arrays in place of edges and cumw
+        template <typename T, typename F>
+        void partition(const T* edges, const double* cumw, std::size_t N, double ncp_prior,
+                       const bb::options& opts, solver<T, F>& dp, std::vector<std::size_t>& cp) {
+
+            // the recursion only depends on edges, cumulative weights and prior
+            std::uint64_t key = 0;
+            cp.clear();
+            if (opts.cache) {
+                hasher h;
+                h.add(F::name(), std::strlen(F::name()));
+                h.add(sizeof(T));
+                h.add(N);
+                h.add(ncp_prior);
+                h.add(edges, (N+1)*sizeof(T));
+                h.add(cumw,  (N+1)*sizeof(double));
+                if (opts.max_block > 0 or opts.grid > 0 or opts.segments > 1) {
+                    h.add(opts.max_block);
+                    h.add(opts.grid);
+                    h.add(opts.segments);
+                }
+                key = h.value();
+                if (opts.cache->lookup(key, N, cp)) return;
+            }
+
+            phase_timer timer(opts.observer);
+
+            // candidate grid: the recursion runs on the cells merged between
+            // grid edges, the prior stays the one of N cells
+            std::vector<std::size_t> grid;
+            std::vector<T> grid_E;
+            bb::array grid_W;
+            make_grid(edges, cumw, N, opts.grid, grid, grid_E, grid_W);
+            const auto n = grid.empty() ? N : grid.size() - 1;
+
+            // do the actual recursive computation
+            dp.reset(opts, ncp_prior);
+            if (opts.segments > 1 and F::prunable) {
+                segmented<T, F>(grid.empty() ? cumw : grid_W.data(), grid.empty() ? edges : grid_E.data(),
+                                n, ncp_prior, opts, dp.last, dp.report);
+                // the stitching only compares with the recursion it runs,
+                // which is not the exact one with a grid or a block limit
+                if (!grid.empty() or opts.max_block > 0) dp.report.certified = false;
+            }
+            else dp.advance(grid.empty() ? cumw : grid_W.data(), grid.empty() ? edges : grid_E.data(), n);
+
+            if (opts.exact_gap and (opts.max_block > 0 or !grid.empty() or opts.segments > 1)) {
+                auto o = opts;
+                o.max_block = 0;
+                o.grid      = 0;
+                o.segments  = 0;
+                o.pruned    = true;
+                solver<T, F> exact(o, ncp_prior);
+                exact.advance(cumw, edges, N);
+                dp.report.gap = exact.report.objective - dp.report.objective;
+            }
+            timer.done(bb::phase::loop);
+            if (opts.report) *opts.report = dp.report;
+            if (opts.observer) opts.observer->on_report(dp.report);
+
+            // iteratively find the change points
+            const auto& last = dp.last;
+            for (auto i = n; i != 0; i = last[i-1]) cp.push_back(grid.empty() ? i : grid[i]);
+            cp.push_back(0);
+            std::reverse(cp.begin(), cp.end());
+            timer.done(bb::phase::backtrack);
+
+            if (opts.cache) opts.cache->store(key, N, cp);
+        }
+
+        template <typename F = fitness::events, typename T>
+        std::vector<std::size_t> partition(const T* edges, const double* cumw, std::size_t N,
+                                           double ncp_prior, const bb::options& opts) {
+            solver<T, F> dp(opts, ncp_prior);
+            std::vector<std::size_t> cp;
+            partition(edges, cumw, N, ncp_prior, opts, dp, cp);
+            return cp;
+        }
+
+        // fitness values precomputed in W, read back with W_k = 0 (the kernels
+        // take differences): the kernels then only add the prior and the best
+        // fitness and keep the first maximum
+        struct precomputed {
+            static double value(double a, double) { return -a; }
+#ifdef BAYESIAN_BLOCKS_X86_SIMD
+            __attribute__((target("avx2,fma")))
+            static __m256d value(__m256d a, __m256d) { return _mm256_sub_pd(_mm256_setzero_pd(), a); }
+            __attribute__((target("avx512f")))
+            static __m512d value(__m512d a, __m512d) { return _mm512_sub_pd(_mm512_setzero_pd(), a); }
+#endif
+        };
+
+        // Optimal partitions for several priors at once (prior scan), with the
+        // same results as partition() for each one. The exhaustive recursion
+        // evaluates the fitness of the blocks ending at each step once for all
+        // the priors, which only repeat additions and comparisons, spread over
+        // the threads. In the pruned mode the candidates differ among priors:
+        // one solver per prior, the solvers run side by side. The edge cache
+        // and options::report are not used
+        template <typename F, typename T>
+        std::vector<std::vector<std::size_t>> partition_scan(const T* edges, const double* cumw,
+                                                             std::size_t N, const bb::array& ncp,
+                                                             const bb::options& opts) {
+
+            const auto P = ncp.size();
+            phase_timer timer(opts.observer);
+
+            std::vector<std::size_t> grid;
+            std::vector<T> grid_E;
+            bb::array grid_W;
+            make_grid(edges, cumw, N, opts.grid, grid, grid_E, grid_W);
+            const auto n = grid.empty() ? N : grid.size() - 1;
+            const auto E = grid.empty() ? edges : grid_E.data();
+            const auto W = grid.empty() ? cumw  : grid_W.data();
+
+            const auto n_threads = pool_size(opts.threads);
+            std::unique_ptr<thread_pool> pool;
+            if (n_threads > 1 and P > 1) pool.reset(new thread_pool(n_threads));
+            const auto stride = pool ? pool->size() : 1;
+
+            // progress and cancellation, from the calling thread only
+            const auto interval = opts.observer ? opts.observer->interval() : n;
+
+            std::vector<std::vector<std::size_t>> last(P);
+
+            if (opts.pruned and F::prunable) {
+                auto o = opts;
+                o.threads  = 1;
+                o.observer = nullptr;
+                std::vector<solver<T, F>> dp;
+                dp.reserve(P);
+                for (std::size_t j = 0; j < P; ++j) dp.emplace_back(o, ncp[j]);
+
+                for (std::size_t k = 0; k < n; ) {
+                    const auto k_end = std::min(n, k + interval);
+                    auto task = [&](unsigned i) {
+                        for (std::size_t j = i; j < P; j += stride) dp[j].advance(W, E, k_end);
+                    };
+                    pool ? pool->run(task) : task(0);
+                    k = k_end;
+                    if (opts.observer) opts.observer->check(k, n);
+                }
+                for (std::size_t j = 0; j < P; ++j) last[j] = std::move(dp[j].last);
+            }
+            else {
+                std::vector<bb::array> best(P);
+                for (std::size_t j = 0; j < P; ++j) {
+                    best[j].reserve(n+1);
+                    best[j].push_back(0.);
+                    last[j].reserve(n);
+                }
+
+                // the fitness row goes through the same kernel as in a single
+                // run, so that every prior sees the same values
+                const auto kernel = select_kernel<F, T>(opts.kernel);
+                const auto reduce = select_kernel<precomputed, T>(opts.kernel);
+                const bb::array zeros(n+1, 0.);
+                bb::array row(n+1);
+                std::vector<argmax_t> partial(stride);
+
+                for (std::size_t k = 0; k < n; ++k) {
+                    const auto lo = opts.max_block > 0 and k+1 > opts.max_block ? k+1 - opts.max_block : 0;
+                    const auto m = k+1 - lo;
+
+                    // fitness of the blocks [r, k]
+                    if (pool and m >= opts.parallel_threshold) {
+                        parallel_argmax(*pool, partial, kernel, W + lo, E + lo, zeros.data(), m,
+                                        W[k+1], E[k+1], 0., row.data());
+                    }
+                    else kernel(W + lo, E + lo, zeros.data(), m, W[k+1], E[k+1], 0., row.data());
+
+                    auto task = [&](unsigned i) {
+                        for (std::size_t j = i; j < P; j += stride) {
+                            auto max = reduce(row.data(), E + lo, best[j].data() + lo, m,
+                                              0., 0., ncp[j], nullptr);
+                            last[j].push_back(max.pos + lo);
+                            best[j].push_back(max.value);
+                        }
+                    };
+                    if (pool and m*P >= opts.parallel_threshold) pool->run(task);
+                    else for (unsigned i = 0; i < stride; ++i) task(i);
+
+                    if (opts.observer and k % interval == 0) opts.observer->check(k, n);
+                }
+            }
+            timer.done(bb::phase::loop);
+
+            // iteratively find the change points
+            std::vector<std::vector<std::size_t>> cp(P);
+            for (std::size_t j = 0; j < P; ++j) {
+                for (auto i = n; i != 0; i = last[j][i-1]) cp[j].push_back(grid.empty() ? i : grid[i]);
+                cp[j].push_back(0);
+                std::reverse(cp[j].begin(), cp[j].end());
+            }
+            timer.done(bb::phase::backtrack);
+
+            return cp;
+        }
+
+        // cumulative bin contents for binned_partition(), with the input checks
+        template <typename T, typename W>
+        bb::array binned_cumw(const T* edges, const W* counts, std::size_t n_bins,
+                              const bb::options& opts) {
+
+            static_assert(std::is_floating_point<T>::value, "edges must be of floating point type");
+            static_assert(std::is_arithmetic<W>::value, "bin contents must be of arithmetic type");
+
+            if (opts.observer) opts.observer->begin();
+            phase_timer timer(opts.observer);
+
+            if (n_bins == 0) {
+                throw std::invalid_argument("ERROR: empty arrays provided as input");
+            }
+
+            // cumulative bin contents, empty bins are fine: a block with no
+            // counts has zero fitness
+            bb::array cumw(n_bins+1);
+            cumw[0] = 0;
+            for (std::size_t i = 0; i < n_bins; ++i) {
+                if (!(counts[i] >= 0)) {
+                    throw std::domain_error("ERROR: invalid bin contents found in input");
+                }
+                if (!(edges[i] < edges[i+1])) {
+                    throw std::invalid_argument("ERROR: bin edges must be strictly increasing");
+                }
+                cumw[i+1] = cumw[i] + counts[i];
+            }
+
+            timer.done(bb::phase::edges);
+            return cumw;
+        }
+
+        // binned data: counts[i] is the content of the bin [edges[i], edges[i+1]),
+        // change points can only be bin edges. Returns their indices in edges
+        template <typename T, typename W>
+        std::vector<std::size_t> binned_partition(const T* edges, const W* counts, std::size_t n_bins,
+                                                  const double p, const bb::options& opts) {
+            const auto cumw = binned_cumw(edges, counts, n_bins, opts);
+            return partition<fitness::binned>(edges, cumw.data(), n_bins,
+                                              fitness::binned::ncp_prior(p, n_bins), opts);
+        }
+
+        // the same, for each prior in ps
+        template <typename T, typename W>
+        std::vector<std::vector<std::size_t>> binned_partition_scan(const T* edges, const W* counts,
+                                                                    std::size_t n_bins,
+                                                                    const std::vector<double>& ps,
+                                                                    const bb::options& opts) {
+            if (ps.empty()) throw std::invalid_argument("ERROR: no prior values provided");
+            const auto cumw = binned_cumw(edges, counts, n_bins, opts);
+            bb::array ncp(ps.size());
+            std::transform(ps.begin(), ps.end(), ncp.begin(),
+                           [n_bins](double p) { return fitness::binned::ncp_prior(p, n_bins); });
+            return partition_scan<fitness::binned>(edges, cumw.data(), n_bins, ncp, opts);
+        }
+    }
+
+    namespace bb {
+
+        // Working memory of blocks(): input copy, sort buffers, edges,
+        // cumulative weights, state of the recursion and result. Once it has
+        // grown to the size of the input, serial calls do not allocate. Not
+        // to be shared among concurrent calls. The edges are in double
+        // precision whatever T, see midpoint_edges()
+        template <typename T>
+        class workspace {
+
+            public:
+
+            workspace() : dp(options(), 0.) {}
+
+            // preallocate for inputs of up to n values
+            void reserve(std::size_t n) {
+                x.reserve(n);
+                x_buf.reserve(n);
+                w.reserve(n);
+                w_buf.reserve(n);
+                edges.reserve(n+1);
+                cumw.reserve(n+1);
+                cp.reserve(n+1);
+                result.reserve(n+1);
+                dp.last.reserve(n);
+                dp.best.reserve(n+1);
+            }
+
+            // values and weights, sorted and merged in place
+            std::vector<T> x, x_buf;
+            bb::array w, w_buf;
+            bb::array edges;
+            bb::array cumw;
+            std::vector<std::size_t> cp;
+            detail::solver<double> dp;
+            // change points of the last call
+            std::vector<T> result;
+        };
+    }
+
+    namespace detail {
+
+        // sort x, moving w along (if not null), or check that it is sorted if
+        // the caller says so. x_buf and w_buf are scratch space. If runs is
+        // not null, x is made of the unsorted chunks between its entries
+        template <typename T, typename W>
+        void sort_input(std::vector<T>& x, W* w, const bb::options& opts,
+                        std::vector<T>& x_buf, std::vector<W>& w_buf,
+                        const std::vector<std::size_t>* runs = nullptr) {
+            if (std::find_if(x.begin(), x.end(), [](T v) { return std::isnan(v); }) != x.end()) {
+                throw std::domain_error("ERROR: invalid values found in input");
+            }
+            if (opts.presorted) {
+                if (!std::is_sorted(x.begin(), x.end())) {
+                    throw std::invalid_argument("ERROR: input values are not sorted");
+                }
+                return;
+            }
+            const auto n_threads = pool_size(opts.threads);
+            if (runs and runs->size() > 2) {
+                thread_pool pool(std::min<std::size_t>(n_threads, runs->size() - 1));
+                detail::sort_runs(x.data(), w, *runs, pool, x_buf, w_buf);
+            }
+            else detail::sort(x.data(), w, x.size(), n_threads, x_buf, w_buf);
+        }
+
+        // Candidate change points of the N sorted distinct values in x: the
+        // first and last values and the midpoints in between. They are
+        // computed in double precision, where the midpoint of two floats is
+        // exact. The midpoint of two adjacent doubles is rounded onto one of
+        // them and would make an empty block, such values are rejected
+        template <typename T>
+        void midpoint_edges(const T* x, std::size_t N, bb::array& edges) {
+            edges.resize(N+1);
+            edges[0] = x[0];
+            for (std::size_t i = 0; i+1 < N; ++i) {
+                edges[i+1] = (static_cast<double>(x[i]) + static_cast<double>(x[i+1]))/2.;
+                if (!(edges[i] < edges[i+1])) {
+                    throw std::invalid_argument("ERROR: values too close to be resolved in double precision found in input");
+                }
+            }
+            edges[N] = x[N-1];
+            if (N > 1 and !(edges[N-1] < edges[N])) {
+                throw std::invalid_argument("ERROR: values too close to be resolved in double precision found in input");
+            }
+        }
+
+        // sort the values in ws.x, with the weights in ws.w if weighted,
+        // otherwise repeated values are merged and counted. Then build the
+        // edges and the cumulative weights in ws. See sort_input() for runs
+        template <typename T>
+        void ingest(bb::workspace<T>& ws, bool weighted, const bb::options& opts,
+                    const std::vector<std::size_t>* runs = nullptr) {
+
+            phase_timer timer(opts.observer);
+
+            if (ws.x.empty()) {
+                throw std::invalid_argument("ERROR: empty arrays provided as input");
+            }
+
+            if (weighted and std::find_if(ws.w.begin(), ws.w.end(),
+                                          [](double v) { return !(v > 0); }) != ws.w.end()) {
+                throw std::domain_error("ERROR: invalid weights found in input");
+            }
+
+            // sort data and weights together, in place
+            if (weighted) {
+                detail::sort_input(ws.x, ws.w.data(), opts, ws.x_buf, ws.w_buf, runs);
+                if (std::adjacent_find(ws.x.begin(), ws.x.end()) != ws.x.end()) {
+                    throw std::invalid_argument("ERROR: duplicated values found in input");
+                }
+            }
+            // or sort, then count repeated values in place
+            else {
+                detail::sort_input(ws.x, static_cast<double*>(nullptr), opts, ws.x_buf, ws.w_buf, runs);
+                detail::run_length_encode(ws.x, ws.w);
+            }
+            timer.done(bb::phase::sort);
+
+            const auto& x = ws.x;
+            const auto N = x.size();
+
+            // build up array with all possible bin edges
+            detail::midpoint_edges(x.data(), N, ws.edges);
+
+            // cumulative weights: the number of counts in the block [r, k] is just
+            // cumw[k+1] - cumw[r]. Integer sums are exact in double precision up to 2^53
+            auto& cumw = ws.cumw;
+            cumw.resize(N+1);
+            cumw[0] = 0;
+            for (std::size_t i = 0; i < N; ++i) cumw[i+1] = cumw[i] + ws.w[i];
+
+            timer.done(bb::phase::edges);
+        }
+
+        // blocks of the values in ws.x, see ingest(). The change points are
+        // written to ws.result
+        template <typename T>
+        void workspace_blocks(bb::workspace<T>& ws, bool weighted, const double p,
+                              const bb::options& opts,
+                              const std::vector<std::size_t>* runs = nullptr) {
+
+            detail::ingest(ws, weighted, opts, runs);
+            const auto& edges = ws.edges;
+            const auto N = edges.size() - 1;
+
+            // let's use here Cash statistics and calibrated prior on number of change points
+            partition(edges.data(), ws.cumw.data(), N, ncp_prior(p, N), opts, ws.dp, ws.cp);
+
+            ws.result.resize(ws.cp.size());
+            std::transform(ws.cp.begin(), ws.cp.end(), ws.result.begin(),
+                           [&edges](std::size_t pos) { return static_cast<T>(edges[pos]); });
+        }
+
+        // blocks of the values in ws.x for each prior in ps, see ingest()
+        template <typename T>
+        std::vector<std::vector<T>> workspace_scan(bb::workspace<T>& ws, bool weighted,
+                                                   const std::vector<double>& ps,
+                                                   const bb::options& opts) {
+
+            if (ps.empty()) throw std::invalid_argument("ERROR: no prior values provided");
+
+            detail::ingest(ws, weighted, opts);
+            const auto& edges = ws.edges;
+            const auto N = edges.size() - 1;
+
+            bb::array ncp(ps.size());
+            std::transform(ps.begin(), ps.end(), ncp.begin(),
+                           [N](double p) { return ncp_prior(p, N); });
+            const auto cp = partition_scan<fitness::events>(edges.data(), ws.cumw.data(), N, ncp, opts);
+
+            std::vector<std::vector<T>> result(cp.size());
+            for (std::size_t j = 0; j < cp.size(); ++j) {
+                result[j].resize(cp[j].size());
+                std::transform(cp[j].begin(), cp[j].end(), result[j].begin(),
+                               [&edges](std::size_t pos) { return static_cast<T>(edges[pos]); });
+            }
+            return result;
+        }
+    }
+
     // core utility
-    bb::array blocks(bb::data_array data, bb::weights_array weights, const double p,
-                     bool counter, bool benchmark) {
+    template <typename T, typename W>
+    std::vector<T> blocks(std::vector<T> data, std::vector<W> weights, const double p,
+                          const bb::options& opts, bool counter, bool benchmark) {
+
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+        static_assert(std::is_arithmetic<W>::value, "weights must be of arithmetic type");
 
-        auto start = bb::clock::now();
+        // legacy flags, printed by an observer
+        if (counter or benchmark) {
+            bb::stream_observer stream(counter, benchmark, opts.observer);
+            auto o = opts;
+            o.observer = &stream;
+            return BayesianBlocks::blocks(std::move(data), std::move(weights), p, o);
+        }
+
+        if (opts.observer) opts.observer->begin();
 
         // sanity checks
         if (data.size() != weights.size()) {
             throw std::domain_error("ERROR: data and weights vectors are of different sizes");
         }
 
-        if (data.size() == 0) {
-            throw std::invalid_argument("ERROR: empty arrays provided as input");
-        }
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        ws.w.assign(weights.begin(), weights.end());
+        detail::workspace_blocks(ws, true, p, opts);
+
+        return std::move(ws.result);
+    }
 
-        if (std::find_if(weights.begin(), weights.end(),
-                         [](int& v) { return v <= 0; }) != weights.end()) {
-            throw std::domain_error("ERROR: invalid weights found in input");
+    template <typename T, typename W>
+    std::vector<T> blocks(std::vector<T> data, std::vector<W> weights, const double p,
+                          bool counter, bool benchmark) {
+        return BayesianBlocks::blocks(std::move(data), std::move(weights), p, bb::options(), counter, benchmark);
+    }
+
+    template <typename T>
+    std::vector<T> blocks(std::vector<T> data, const double p,
+                          const bb::options& opts, bool counter, bool benchmark) {
+
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+
+        // legacy flags, printed by an observer
+        if (counter or benchmark) {
+            bb::stream_observer stream(counter, benchmark, opts.observer);
+            auto o = opts;
+            o.observer = &stream;
+            return BayesianBlocks::blocks(std::move(data), p, o);
         }
 
-        if (std::unique(data.begin(), data.end()) != data.end()) {
-            throw std::invalid_argument("ERROR: duplicated values found in input");
+        if (opts.observer) opts.observer->begin();
+
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        detail::workspace_blocks(ws, false, p, opts);
+
+        return std::move(ws.result);
+    }
+
+    template <typename T>
+    std::vector<T> blocks(std::vector<T> data, const double p,
+                          bool counter, bool benchmark) {
+        return BayesianBlocks::blocks(data, p, bb::options(), counter, benchmark);
+    }
+
+    template <typename It, typename T>
+    const std::vector<T>& blocks(It first, It last, const double p, bb::workspace<T>& ws,
+                                 const bb::options& opts) {
+
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+
+        if (opts.observer) opts.observer->begin();
+
+        ws.x.assign(first, last);
+        detail::workspace_blocks(ws, false, p, opts);
+
+        return ws.result;
+    }
+
+    template <typename It, typename WIt, typename T>
+    const std::vector<T>& blocks(It first, It last, WIt w_first, const double p,
+                                 bb::workspace<T>& ws, const bb::options& opts) {
+
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+        static_assert(std::is_arithmetic<typename std::iterator_traits<WIt>::value_type>::value,
+                      "weights must be of arithmetic type");
+
+        if (opts.observer) opts.observer->begin();
+
+        ws.x.assign(first, last);
+        ws.w.resize(ws.x.size());
+        std::copy_n(w_first, ws.x.size(), ws.w.begin());
+        detail::workspace_blocks(ws, true, p, opts);
+
+        return ws.result;
+    }
+
+    template <typename T>
+    const std::vector<T>& blocks_chunks(std::vector<std::vector<T>>& chunks, const double p,
+                                        bb::workspace<T>& ws, const bb::options& opts) {
+
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+
+        if (opts.observer) opts.observer->begin();
+
+        // concatenate, releasing the chunks on the way
+        std::vector<std::size_t> runs(1, 0);
+        for (const auto& c : chunks) {
+            if (!c.empty()) runs.push_back(runs.back() + c.size());
+        }
+        ws.x.resize(runs.back());
+        auto out = ws.x.begin();
+        for (auto& c : chunks) {
+            out = std::copy(c.begin(), c.end(), out);
+            std::vector<T>().swap(c);
         }
+        detail::workspace_blocks(ws, false, p, opts, &runs);
+
+        return ws.result;
+    }
 
-        const auto N = data.size();
+    template <typename T>
+    std::vector<T> blocks_chunks(std::vector<std::vector<T>> chunks, const double p,
+                                 const bb::options& opts) {
+        bb::workspace<T> ws;
+        BayesianBlocks::blocks_chunks(chunks, p, ws, opts);
+        return std::move(ws.result);
+    }
+
+    template <typename T, typename W>
+    std::vector<std::vector<T>> blocks_scan(std::vector<T> data, std::vector<W> weights,
+                                            const std::vector<double>& ps, const bb::options& opts) {
+
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+        static_assert(std::is_arithmetic<W>::value, "weights must be of arithmetic type");
 
-        // sort and copy data
-        std::vector<bb::pair> hist; hist.reserve(N);
-        for (std::size_t i = 0; i < N; ++i) hist.emplace_back(data[i], weights[i]);
-        std::sort(hist.begin(), hist.end(), [](bb::pair a, bb::pair b) { return a.first < b.first; });
-        for (size_t i = 0; i < N; ++i) {
-            data[i]    = hist[i].first;
-            weights[i] = hist[i].second;
+        if (opts.observer) opts.observer->begin();
+
+        if (data.size() != weights.size()) {
+            throw std::domain_error("ERROR: data and weights vectors are of different sizes");
         }
 
-        // build up array with all possible bin edges
-        bb::array edges(N+1);
-        edges[0]   = data[0];
-        for (std::size_t i = 0; i < N-1; ++i) edges[i+1] = (data[i]+data[i+1])/2.;
-        edges[N]   = data[N-1];
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        ws.w.assign(weights.begin(), weights.end());
+        return detail::workspace_scan(ws, true, ps, opts);
+    }
 
-        assert(std::unique(edges.begin(), edges.end()) == edges.end());
+    template <typename T>
+    std::vector<std::vector<T>> blocks_scan(std::vector<T> data, const std::vector<double>& ps,
+                                            const bb::options& opts) {
 
-        // let's use here Cash statistics and calibrated prior on number of change points
-        auto cash = [](int N_k, double T_k) { return N_k * std::log(N_k/T_k); };
-        auto ncp_prior = std::log(73.53 * p * std::pow(N, -0.478)) - 4;
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
 
-        // arrays to store results
-        bb::array last(N);
-        bb::array best(N);
+        if (opts.observer) opts.observer->begin();
 
-        auto init_time = bb::duration_cast<bb::us>(bb::clock::now() - start).count();
-        start = bb::clock::now();
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        return detail::workspace_scan(ws, false, ps, opts);
+    }
 
-        // do the actual recursive computation
-        for (std::size_t k = 0; k < N; ++k ) {
-            bb::array A(k+1);
-            for (std::size_t r = 0; r == 0 or r <= k; ++r) {
-                A[r] = cash(
-                            std::accumulate(weights.begin()+r, weights.begin()+k+1, 0),
-                            edges[k+1] - edges[r]
-                       ) + ncp_prior + (r == 0 ? 0 : best[r-1]);
-            }
-            last[k] = std::distance(A.begin(), std::max_element(A.begin(), A.end()));
-            best[k] = *(std::max_element(A.begin(), A.end()));
+    template <typename T, typename W>
+    std::vector<T> blocks_binned(const std::vector<T>& edges, const std::vector<W>& counts,
+                                 const double p, const bb::options& opts,
+                                 bool counter, bool benchmark) {
 
-            if (counter) std::cout << '\r' << k << '/' << N << std::flush;
+        if (edges.size() != counts.size() + 1) {
+            throw std::domain_error("ERROR: edges must have one more element than counts");
         }
-        if (counter) std::cout << std::endl;
 
-        auto loop_time = bb::duration_cast<bb::us>(bb::clock::now() - start).count();
-        start = bb::clock::now();
+        // legacy flags, printed by an observer
+        if (counter or benchmark) {
+            bb::stream_observer stream(counter, benchmark, opts.observer);
+            auto o = opts;
+            o.observer = &stream;
+            return BayesianBlocks::blocks_binned(edges, counts, p, o);
+        }
 
-        // iteratively find the change points
-        std::vector<int> cp;
-        for (auto i = N; i != 0; i = last[i-1]) cp.push_back(i);
-        cp.push_back(0);
+        auto cp = detail::binned_partition(edges.data(), counts.data(), counts.size(), p, opts);
 
-        std::reverse(cp.begin(), cp.end());
-        bb::array result(cp.size(), 0);
+        std::vector<T> result(cp.size());
         std::transform(cp.begin(), cp.end(), result.begin(),
-                       [edges](size_t pos) { return edges[pos]; });
-
-        auto end_time = bb::duration_cast<bb::us>(bb::clock::now() - start).count();
-
-        if (benchmark) {
-            std::cout << "init: ";
-            init_time > 1000 ?
-                std::cout << init_time/1.E3 << " s" :
-                std::cout << init_time      << " us";
-            std::cout << std::endl;
-            std::cout << "loop: ";
-            loop_time > 1000 ?
-                std::cout << loop_time/1.E3 << " s" :
-                std::cout << loop_time      << " us";
-            std::cout << std::endl;
-            std::cout << "end: ";
-            end_time > 1000 ?
-                std::cout << end_time/1.E3 << " s" :
-                std::cout << end_time      << " us";
-            std::cout << std::endl;
-        }
+                       [&edges](std::size_t pos) { return edges[pos]; });
 
         return result;
     }
 
-    bb::array blocks(bb::data_array data, const double p,
-                     bool counter, bool benchmark) {
+    template <typename T, typename W>
+    std::vector<T> blocks_binned(const std::vector<T>& edges, const std::vector<W>& counts,
+                                 const double p, bool counter, bool benchmark) {
+        return BayesianBlocks::blocks_binned(edges, counts, p, bb::options(), counter, benchmark);
+    }
+
+    template <typename T>
+    std::vector<T> blocks_measurements(std::vector<T> x, const std::vector<T>& y,
+                                       const std::vector<T>& sigma, const double p,
+                                       const bb::options& opts) {
+
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+
+        if (opts.observer) opts.observer->begin();
+        detail::phase_timer timer(opts.observer);
+
+        // sanity checks
+        if (x.size() != y.size() or x.size() != sigma.size()) {
+            throw std::domain_error("ERROR: positions, values and errors vectors are of different sizes");
+        }
 
-        // compute weights
-        std::map<double, int> hist;
-        for (auto& i : data) {
-            if (hist.find(i) == hist.end()) hist.emplace(i, 1);
-            else hist[i]++;
+        if (x.size() == 0) {
+            throw std::invalid_argument("ERROR: empty arrays provided as input");
         }
 
-        bb::data_array x;
-        bb::weights_array weights;
-        for (auto& i : hist) {
-            x      .push_back(i.first);
-            weights.push_back(i.second);
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            if (!std::isfinite(y[i]) or !(sigma[i] > 0) or !std::isfinite(sigma[i])) {
+                throw std::domain_error("ERROR: invalid measurements found in input");
+            }
         }
 
-        return BayesianBlocks::blocks(x, weights, p, counter, benchmark);
+        // sort the positions, keeping track of the measurements
+        std::vector<std::size_t> order(x.size()), order_buf;
+        std::iota(order.begin(), order.end(), 0);
+        std::vector<T> x_buf;
+        detail::sort_input(x, order.data(), opts, x_buf, order_buf);
+
+        // cumulative sums of 1/sigma^2 and y/sigma^2, the two arrays of the
+        // fitness, one cell per distinct position
+        bb::array cum_a(1, 0.), cum_b(1, 0.);
+        std::size_t N = 0;
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            const double s = sigma[order[i]];
+            const double w = 1./(s*s);
+            if (i == 0 or x[i] != x[i-1]) {
+                x[N++] = x[i];
+                cum_a.push_back(cum_a.back());
+                cum_b.push_back(cum_b.back());
+            }
+            cum_a.back() += w;
+            cum_b.back() += w * y[order[i]];
+        }
+        x.resize(N);
+        timer.done(bb::phase::sort);
+
+        // the change points are chosen among the midpoints
+        bb::array edges;
+        detail::midpoint_edges(x.data(), N, edges);
+        timer.done(bb::phase::edges);
+
+        auto cp = detail::partition<fitness::measurements>(
+            cum_b.data(), cum_a.data(), N, fitness::measurements::ncp_prior(p, N), opts);
+
+        std::vector<T> result(cp.size());
+        std::transform(cp.begin(), cp.end(), result.begin(),
+                       [&edges](std::size_t pos) { return static_cast<T>(edges[pos]); });
+
+        return result;
+    }
+
+#ifdef BAYESIAN_BLOCKS_DEFINITIONS
+    BAYESIAN_BLOCKS_INLINE bb::array blocks(bb::data_array data, bb::weights_array weights, const double p,
+                                            const bb::options& opts, bool counter, bool benchmark) {
+        return BayesianBlocks::blocks<double, int>(data, weights, p, opts, counter, benchmark);
+    }
+
+    BAYESIAN_BLOCKS_INLINE bb::array blocks(bb::data_array data, bb::weights_array weights, const double p,
+                                            bool counter, bool benchmark) {
+        return BayesianBlocks::blocks<double, int>(data, weights, p, bb::options(), counter, benchmark);
+    }
+
+    BAYESIAN_BLOCKS_INLINE bb::array blocks(bb::data_array data, const double p,
+                                            const bb::options& opts, bool counter, bool benchmark) {
+        return BayesianBlocks::blocks<double>(data, p, opts, counter, benchmark);
     }
+
+    BAYESIAN_BLOCKS_INLINE bb::array blocks(bb::data_array data, const double p,
+                                            bool counter, bool benchmark) {
+        return BayesianBlocks::blocks<double>(data, p, bb::options(), counter, benchmark);
+    }
+#endif
 }
 
+// explicit instantiations of the engine for the supported value types, inside
+// namespace BayesianBlocks. The library (src/bayesian_blocks.cc) defines them,
+// with BAYESIAN_BLOCKS_COMPILED_LIB they are declared extern here. Weights of
+// any type are converted to double in the workspace, so the engine only
+// depends on the value type. The fitness kernels of every instruction set are
+// instantiated through select_kernel()
+#define BAYESIAN_BLOCKS_INSTANTIATE(EXTERN, T) \
+    EXTERN template detail::argmax_kernel<T> detail::select_kernel<fitness::events, T>(bb::simd); \
+    EXTERN template detail::argmax_kernel<T> detail::select_kernel<fitness::binned, T>(bb::simd); \
+    EXTERN template class detail::solver<T, fitness::events>; \
+    EXTERN template class detail::solver<T, fitness::binned>; \
+    EXTERN template void detail::partition<T, fitness::events>( \
+        const T*, const double*, std::size_t, double, const bb::options&, \
+        detail::solver<T, fitness::events>&, std::vector<std::size_t>&); \
+    EXTERN template void detail::partition<T, fitness::binned>( \
+        const T*, const double*, std::size_t, double, const bb::options&, \
+        detail::solver<T, fitness::binned>&, std::vector<std::size_t>&); \
+    EXTERN template std::vector<std::vector<std::size_t>> detail::partition_scan<fitness::events, T>( \
+        const T*, const double*, std::size_t, const bb::array&, const bb::options&); \
+    EXTERN template std::vector<std::vector<std::size_t>> detail::partition_scan<fitness::binned, T>( \
+        const T*, const double*, std::size_t, const bb::array&, const bb::options&); \
+    EXTERN template void detail::ingest<T>( \
+        bb::workspace<T>&, bool, const bb::options&, const std::vector<std::size_t>*); \
+    EXTERN template void detail::workspace_blocks<T>( \
+        bb::workspace<T>&, bool, double, const bb::options&, const std::vector<std::size_t>*); \
+    EXTERN template std::vector<std::vector<T>> detail::workspace_scan<T>( \
+        bb::workspace<T>&, bool, const std::vector<double>&, const bb::options&);
+
+// point measurements are always in double precision
+#define BAYESIAN_BLOCKS_INSTANTIATE_MEASUREMENTS(EXTERN) \
+    EXTERN template detail::argmax_kernel<double> detail::select_kernel<fitness::measurements, double>(bb::simd); \
+    EXTERN template class detail::solver<double, fitness::measurements>; \
+    EXTERN template void detail::partition<double, fitness::measurements>( \
+        const double*, const double*, std::size_t, double, const bb::options&, \
+        detail::solver<double, fitness::measurements>&, std::vector<std::size_t>&);
+
+#ifdef BAYESIAN_BLOCKS_EXTERN_TEMPLATES
+namespace BayesianBlocks {
+    BAYESIAN_BLOCKS_INSTANTIATE(extern, float)
+    BAYESIAN_BLOCKS_INSTANTIATE(extern, double)
+    BAYESIAN_BLOCKS_INSTANTIATE_MEASUREMENTS(extern)
+}
+#endif
+
 #endif
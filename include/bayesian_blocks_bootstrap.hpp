@@ -0,0 +1,294 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "bayesian_blocks.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_BOOTSTRAP_HH
+#define _BAYESIAN_BLOCKS_BOOTSTRAP_HH
+
+namespace BayesianBlocks {
+
+    namespace bb {
+
+        // change points of resampled datasets, see blocks_bootstrap()
+        template <typename T = double>
+        struct replicas {
+            // change points of the data itself
+            std::vector<T> nominal;
+            // change points of each replica, empty if no value was drawn
+            std::vector<std::vector<T>> change_points;
+            // edges of the data and how many replicas have a change point
+            // between the same two values as each one, first and last
+            // excluded: the distribution of the change point positions
+            std::vector<T> edges;
+            std::vector<std::size_t> counts;
+            // n_blocks[k]: how many replicas have k blocks
+            std::vector<std::size_t> n_blocks;
+        };
+    }
+
+    // Uncertainties on the change points: the recursion is run again on
+    // n_replicas datasets resampled from the input. The input is sorted and
+    // merged once, the replicas only draw new weights for its distinct
+    // values: the ones left with none are skipped, the edges of the others
+    // are built in a single pass. Each replica has the change points of
+    // blocks() on the values drawn.
+    //
+    // Bootstrap: Poisson reweighting, every event gets a Poisson(1) weight,
+    // i.e. a value counted k times gets Poisson(k). Fractional weights w
+    // become w * Poisson(1). Replica i draws from a generator seeded with
+    // (seed, i), so the results do not depend on opts.threads. Values drawn
+    // more than once are denser than their neighbours: replicas tend to have
+    // more blocks than the data, compare positions rather than counts.
+    //
+    // The replicas are spread over opts.threads threads, each one with its
+    // own recursion state and buffers, reused from one replica to the next.
+    // Set opts.pruned for large inputs. The edge cache and opts.report are
+    // not used for the replicas
+    template <typename T, typename W>
+    bb::replicas<T> blocks_bootstrap(std::vector<T> data, std::vector<W> weights, const double p,
+                                     std::size_t n_replicas, const bb::options& opts = bb::options(),
+                                     std::uint64_t seed = 0);
+
+    template <typename T>
+    bb::replicas<T> blocks_bootstrap(std::vector<T> data, const double p, std::size_t n_replicas,
+                                     const bb::options& opts = bb::options(), std::uint64_t seed = 0);
+
+    // Grouped jackknife: the distinct values are dealt into n_groups groups in
+    // turn, replica g leaves group g out
+    template <typename T, typename W>
+    bb::replicas<T> blocks_jackknife(std::vector<T> data, std::vector<W> weights, const double p,
+                                     std::size_t n_groups, const bb::options& opts = bb::options());
+
+    template <typename T>
+    bb::replicas<T> blocks_jackknife(std::vector<T> data, const double p, std::size_t n_groups,
+                                     const bb::options& opts = bb::options());
+
+    namespace detail {
+
+        // Poisson(mean) variate: inversion for small means, the standard
+        // distribution otherwise
+        template <typename G>
+        double poisson(G& gen, double mean) {
+            if (mean < 30) {
+                std::uniform_real_distribution<double> uniform;
+                const auto u = uniform(gen);
+                double k = 0, term = std::exp(-mean), cdf = term;
+                while (u > cdf and term > 0) {
+                    ++k;
+                    term *= mean / k;
+                    cdf += term;
+                }
+                return k;
+            }
+            std::poisson_distribution<long long> dist(mean);
+            return static_cast<double>(dist(gen));
+        }
+
+        enum class resampling { bootstrap, jackknife };
+
+        // replicas of the values in ws.x, see ingest()
+        template <typename T>
+        bb::replicas<T> workspace_replicas(bb::workspace<T>& ws, bool weighted, const double p,
+                                           std::size_t n, resampling kind, std::uint64_t seed,
+                                           const bb::options& opts) {
+
+            if (n == 0) throw std::invalid_argument("ERROR: no replicas requested");
+
+            detail::workspace_blocks(ws, weighted, p, opts);
+            const auto& x = ws.x;
+            const auto& w = ws.w;
+            const auto N = x.size();
+
+            if (kind == resampling::jackknife and (n < 2 or n > N)) {
+                throw std::invalid_argument("ERROR: the jackknife needs from 2 groups to one per distinct value");
+            }
+
+            // counts are resampled as counts, anything else by a factor
+            const bool counts = std::all_of(w.begin(), w.end(),
+                                            [](double v) { return v == std::floor(v); });
+
+            bb::replicas<T> result;
+            result.nominal = ws.result;
+            result.change_points.resize(n);
+            // indices of the values following the inner change points of each
+            // replica, the edges in T may not tell the gaps apart
+            std::vector<std::vector<std::size_t>> gaps(n);
+
+            // the replicas are the parallel part, each one runs serially
+            auto o = opts;
+            o.threads  = 1;
+            o.cache    = nullptr;
+            o.report   = nullptr;
+            o.observer = nullptr;
+
+            const auto n_threads = std::min<std::size_t>(n, pool_size(opts.threads));
+            thread_pool pool(n_threads);
+            std::atomic<std::size_t> next(0);
+
+            auto task = [&](unsigned) {
+                // recursion state and buffers of this thread
+                solver<double> dp(o, 0.);
+                bb::array rw(N), cumw, E;
+                std::vector<std::size_t> cp, idx;
+                cumw.reserve(N+1);
+                E.reserve(N+1);
+                idx.reserve(N);
+                for (auto r = next++; r < n; r = next++) {
+                    if (kind == resampling::bootstrap) {
+                        std::seed_seq seq = { std::uint32_t(seed), std::uint32_t(seed >> 32),
+                                              std::uint32_t(r), std::uint32_t(std::uint64_t(r) >> 32) };
+                        std::mt19937_64 gen(seq);
+                        for (std::size_t i = 0; i < N; ++i) {
+                            rw[i] = counts ? poisson(gen, w[i]) : w[i] * poisson(gen, 1.);
+                        }
+                    }
+                    else {
+                        for (std::size_t i = 0; i < N; ++i) rw[i] = i % n == r ? 0. : w[i];
+                    }
+
+                    // the values drawn, still sorted: edges and cumulative
+                    // weights as ingest() would build them
+                    cumw.assign(1, 0.);
+                    E.clear();
+                    idx.clear();
+                    const T* prev = nullptr;
+                    for (std::size_t i = 0; i < N; ++i) {
+                        if (rw[i] == 0) continue;
+                        E.push_back(prev ? (static_cast<double>(*prev) + x[i])/2. : x[i]);
+                        cumw.push_back(cumw.back() + rw[i]);
+                        idx.push_back(i);
+                        prev = &x[i];
+                    }
+                    auto& out = result.change_points[r];
+                    if (E.empty()) {
+                        out.clear();
+                        continue;
+                    }
+                    E.push_back(*prev);
+
+                    const auto M = E.size() - 1;
+                    partition(E.data(), cumw.data(), M, ncp_prior(p, M), o, dp, cp);
+                    out.resize(cp.size());
+                    std::transform(cp.begin(), cp.end(), out.begin(),
+                                   [&E](std::size_t pos) { return static_cast<T>(E[pos]); });
+                    gaps[r].resize(cp.size() - 2);
+                    for (std::size_t j = 1; j + 1 < cp.size(); ++j) gaps[r][j-1] = idx[cp[j]];
+                }
+            };
+            pool.run(task);
+
+            // distributions: counts per gap between consecutive values, the
+            // one of each edge of the data
+            result.edges.assign(ws.edges.begin(), ws.edges.end());
+            result.counts.assign(N+1, 0);
+            for (std::size_t r = 0; r < n; ++r) {
+                const auto& cps = result.change_points[r];
+                if (cps.empty()) continue;
+                const auto n_blocks = cps.size() - 1;
+                if (result.n_blocks.size() <= n_blocks) result.n_blocks.resize(n_blocks + 1, 0);
+                ++result.n_blocks[n_blocks];
+                for (auto g : gaps[r]) ++result.counts[g];
+            }
+            return result;
+        }
+    }
+
+    template <typename T, typename W>
+    bb::replicas<T> blocks_bootstrap(std::vector<T> data, std::vector<W> weights, const double p,
+                                     std::size_t n_replicas, const bb::options& opts, std::uint64_t seed) {
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+        static_assert(std::is_arithmetic<W>::value, "weights must be of arithmetic type");
+
+        if (opts.observer) opts.observer->begin();
+
+        if (data.size() != weights.size()) {
+            throw std::domain_error("ERROR: data and weights vectors are of different sizes");
+        }
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        ws.w.assign(weights.begin(), weights.end());
+        return detail::workspace_replicas(ws, true, p, n_replicas, detail::resampling::bootstrap, seed, opts);
+    }
+
+    template <typename T>
+    bb::replicas<T> blocks_bootstrap(std::vector<T> data, const double p, std::size_t n_replicas,
+                                     const bb::options& opts, std::uint64_t seed) {
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+
+        if (opts.observer) opts.observer->begin();
+
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        return detail::workspace_replicas(ws, false, p, n_replicas, detail::resampling::bootstrap, seed, opts);
+    }
+
+    template <typename T, typename W>
+    bb::replicas<T> blocks_jackknife(std::vector<T> data, std::vector<W> weights, const double p,
+                                     std::size_t n_groups, const bb::options& opts) {
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+        static_assert(std::is_arithmetic<W>::value, "weights must be of arithmetic type");
+
+        if (opts.observer) opts.observer->begin();
+
+        if (data.size() != weights.size()) {
+            throw std::domain_error("ERROR: data and weights vectors are of different sizes");
+        }
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        ws.w.assign(weights.begin(), weights.end());
+        return detail::workspace_replicas(ws, true, p, n_groups, detail::resampling::jackknife, 0, opts);
+    }
+
+    template <typename T>
+    bb::replicas<T> blocks_jackknife(std::vector<T> data, const double p, std::size_t n_groups,
+                                     const bb::options& opts) {
+        static_assert(std::is_floating_point<T>::value, "data must be of floating point type");
+
+        if (opts.observer) opts.observer->begin();
+
+        bb::workspace<T> ws;
+        ws.x = std::move(data);
+        return detail::workspace_replicas(ws, false, p, n_groups, detail::resampling::jackknife, 0, opts);
+    }
+}
+
+// see BAYESIAN_BLOCKS_INSTANTIATE in bayesian_blocks.hpp
+#define BAYESIAN_BLOCKS_INSTANTIATE_BOOTSTRAP(EXTERN, T) \
+    EXTERN template bb::replicas<T> detail::workspace_replicas<T>( \
+        bb::workspace<T>&, bool, double, std::size_t, detail::resampling, std::uint64_t, \
+        const bb::options&);
+
+#ifdef BAYESIAN_BLOCKS_EXTERN_TEMPLATES
+namespace BayesianBlocks {
+    BAYESIAN_BLOCKS_INSTANTIATE_BOOTSTRAP(extern, float)
+    BAYESIAN_BLOCKS_INSTANTIATE_BOOTSTRAP(extern, double)
+}
+#endif
+
+#endif
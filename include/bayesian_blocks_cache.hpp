@@ -0,0 +1,265 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include "bayesian_blocks_config.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_CACHE_HH
+#define _BAYESIAN_BLOCKS_CACHE_HH
+
+namespace BayesianBlocks {
+
+    // On-disk cache of optimal partitions, addressed by a hash of the input of
+    // the recursion (bin edges, cumulative weights and prior), so a dataset
+    // that has already been processed skips the computation entirely.
+    //
+    // Each result is stored in its own file, <dir>/<key>.bbe, and the binary
+    // index <dir>/index.bbi keeps sizes and last access of all entries for
+    // least-recently-used eviction. The index is read on construction and
+    // written back by flush() and on destruction. A cache can be shared among
+    // threads, not among concurrent processes
+    class edge_cache {
+
+        public:
+
+        // max_bytes is the limit on the total size of the entries, 0 means no limit
+        edge_cache(const std::string& dir, std::uint64_t max_bytes = 0);
+        ~edge_cache();
+
+        edge_cache(const edge_cache&) = delete;
+        edge_cache& operator=(const edge_cache&) = delete;
+
+        // change points of the partition of n cells with the given key, if cached
+        bool lookup(std::uint64_t key, std::size_t n, std::vector<std::size_t>& cp);
+        void store(std::uint64_t key, std::size_t n, const std::vector<std::size_t>& cp);
+
+        // write the index to disk
+        void flush();
+
+        // counters
+        std::size_t hits()      const { std::lock_guard<std::mutex> lock(mtx); return n_hits; }
+        std::size_t misses()    const { std::lock_guard<std::mutex> lock(mtx); return n_misses; }
+        std::size_t evictions() const { std::lock_guard<std::mutex> lock(mtx); return n_evictions; }
+        std::size_t entries()   const { std::lock_guard<std::mutex> lock(mtx); return index.size(); }
+        std::uint64_t bytes()   const { std::lock_guard<std::mutex> lock(mtx); return total; }
+
+        private:
+
+        struct entry {
+            std::uint64_t bytes;
+            std::uint64_t tick; // last access
+        };
+
+        std::string path(std::uint64_t key) const;
+        void evict();
+
+        std::string dir;
+        std::uint64_t max_bytes;
+        mutable std::mutex mtx;
+        std::unordered_map<std::uint64_t, entry> index;
+        std::uint64_t tick = 0, total = 0;
+        std::size_t n_hits = 0, n_misses = 0, n_evictions = 0;
+        bool dirty = false;
+    };
+
+    namespace detail {
+
+        // FNV-1a, 64 bit
+        class hasher {
+            public:
+            void add(const void* data, std::size_t n) {
+                auto p = static_cast<const unsigned char*>(data);
+                for (std::size_t i = 0; i < n; ++i) {
+                    h ^= p[i];
+                    h *= 0x100000001b3ULL;
+                }
+            }
+            template <typename T>
+            void add(const T& v) { add(&v, sizeof(T)); }
+            std::uint64_t value() const { return h; }
+
+            private:
+            std::uint64_t h = 0xcbf29ce484222325ULL;
+        };
+
+        // binary files: header of magic number, version and number of records
+        const std::uint64_t cache_magic   = 0x3165676465626262ULL; // "bbbedge1"
+        const std::uint64_t cache_version = 1;
+
+        inline bool read_u64(std::FILE* f, std::uint64_t* v, std::size_t n = 1) {
+            return std::fread(v, sizeof(std::uint64_t), n, f) == n;
+        }
+
+        inline bool write_u64(std::FILE* f, const std::uint64_t* v, std::size_t n = 1) {
+            return std::fwrite(v, sizeof(std::uint64_t), n, f) == n;
+        }
+    }
+}
+
+#ifdef BAYESIAN_BLOCKS_DEFINITIONS
+namespace BayesianBlocks {
+
+    BAYESIAN_BLOCKS_INLINE edge_cache::edge_cache(const std::string& dir, std::uint64_t max_bytes) :
+        dir(dir),
+        max_bytes(max_bytes) {
+
+        if (::mkdir(dir.c_str(), 0755) != 0 and errno != EEXIST) {
+            throw std::runtime_error("ERROR: could not create cache directory " + dir);
+        }
+
+        // a missing or corrupted index means an empty cache, stale entry
+        // files are overwritten when stored again
+        auto f = std::fopen((dir + "/index.bbi").c_str(), "rb");
+        if (!f) return;
+        std::uint64_t header[3];
+        if (detail::read_u64(f, header, 3) and
+            header[0] == detail::cache_magic and header[1] == detail::cache_version) {
+            std::uint64_t rec[3]; // key, bytes, tick
+            for (std::uint64_t i = 0; i < header[2] and detail::read_u64(f, rec, 3); ++i) {
+                index[rec[0]] = { rec[1], rec[2] };
+                total += rec[1];
+                tick = std::max(tick, rec[2]);
+            }
+        }
+        std::fclose(f);
+    }
+
+    BAYESIAN_BLOCKS_INLINE edge_cache::~edge_cache() {
+        try { flush(); }
+        catch (...) {}
+    }
+
+    BAYESIAN_BLOCKS_INLINE std::string edge_cache::path(std::uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.bbe", static_cast<unsigned long long>(key));
+        return dir + name;
+    }
+
+    BAYESIAN_BLOCKS_INLINE bool edge_cache::lookup(std::uint64_t key, std::size_t n, std::vector<std::size_t>& cp) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto it = index.find(key);
+        if (it == index.end()) {
+            ++n_misses;
+            return false;
+        }
+
+        // the entry file repeats key and number of cells as a consistency check
+        bool ok = false;
+        auto f = std::fopen(path(key).c_str(), "rb");
+        if (f) {
+            std::uint64_t header[4]; // magic, key, cells, change points
+            if (detail::read_u64(f, header, 4) and header[0] == detail::cache_magic and
+                header[1] == key and header[2] == n and header[3] <= n+1) {
+                std::vector<std::uint64_t> buf(header[3]);
+                if (detail::read_u64(f, buf.data(), buf.size())) {
+                    cp.assign(buf.begin(), buf.end());
+                    ok = true;
+                }
+            }
+            std::fclose(f);
+        }
+
+        if (!ok) {
+            total -= it->second.bytes;
+            index.erase(it);
+            dirty = true;
+            ++n_misses;
+            return false;
+        }
+
+        it->second.tick = ++tick;
+        dirty = true;
+        ++n_hits;
+        return true;
+    }
+
+    BAYESIAN_BLOCKS_INLINE void edge_cache::store(std::uint64_t key, std::size_t n, const std::vector<std::size_t>& cp) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        std::vector<std::uint64_t> buf = { detail::cache_magic, key, n, cp.size() };
+        buf.insert(buf.end(), cp.begin(), cp.end());
+        const std::uint64_t size = buf.size() * sizeof(std::uint64_t);
+
+        // a failed write only costs a recomputation next time
+        auto f = std::fopen(path(key).c_str(), "wb");
+        if (!f) return;
+        const bool ok = detail::write_u64(f, buf.data(), buf.size());
+        if (std::fclose(f) != 0 or !ok) {
+            std::remove(path(key).c_str());
+            return;
+        }
+
+        auto it = index.find(key);
+        if (it != index.end()) total -= it->second.bytes;
+        index[key] = { size, ++tick };
+        total += size;
+        dirty = true;
+
+        evict();
+    }
+
+    // drop least recently used entries until the size limit is met
+    BAYESIAN_BLOCKS_INLINE void edge_cache::evict() {
+        if (max_bytes == 0) return;
+        while (total > max_bytes and !index.empty()) {
+            auto lru = index.begin();
+            for (auto it = index.begin(); it != index.end(); ++it) {
+                if (it->second.tick < lru->second.tick) lru = it;
+            }
+            std::remove(path(lru->first).c_str());
+            total -= lru->second.bytes;
+            index.erase(lru);
+            ++n_evictions;
+        }
+    }
+
+    BAYESIAN_BLOCKS_INLINE void edge_cache::flush() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!dirty) return;
+
+        // write to a temporary file first, so that the index is never truncated
+        const auto name = dir + "/index.bbi";
+        auto f = std::fopen((name + ".tmp").c_str(), "wb");
+        if (!f) throw std::runtime_error("ERROR: could not write cache index " + name);
+        const std::uint64_t header[3] = { detail::cache_magic, detail::cache_version, index.size() };
+        bool ok = detail::write_u64(f, header, 3);
+        for (auto& e : index) {
+            const std::uint64_t rec[3] = { e.first, e.second.bytes, e.second.tick };
+            ok = ok and detail::write_u64(f, rec, 3);
+        }
+        if (std::fclose(f) != 0 or !ok or std::rename((name + ".tmp").c_str(), name.c_str()) != 0) {
+            std::remove((name + ".tmp").c_str());
+            throw std::runtime_error("ERROR: could not write cache index " + name);
+        }
+        dirty = false;
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef _BAYESIAN_BLOCKS_CONFIG_HH
+#define _BAYESIAN_BLOCKS_CONFIG_HH
+
+// build modes:
+// - header-only (default): every definition is visible and inline
+// - BAYESIAN_BLOCKS_COMPILED_LIB: link against libbayesianblocks, the headers
+//   only declare the non-template functions and the float/double instances of
+//   the engine templates are declared extern, i.e. compiled once in the library
+// - BAYESIAN_BLOCKS_SOURCE: set by the library sources only, that provide the
+//   (non-inline) definitions and the explicit instantiations
+#if defined(BAYESIAN_BLOCKS_SOURCE)
+#define BAYESIAN_BLOCKS_DEFINITIONS
+#define BAYESIAN_BLOCKS_INLINE
+#elif defined(BAYESIAN_BLOCKS_COMPILED_LIB)
+#define BAYESIAN_BLOCKS_EXTERN_TEMPLATES
+#define BAYESIAN_BLOCKS_INLINE
+#else
+#define BAYESIAN_BLOCKS_DEFINITIONS
+#define BAYESIAN_BLOCKS_INLINE inline
+#endif
+
+#endif
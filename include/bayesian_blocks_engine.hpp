@@ -0,0 +1,179 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "bayesian_blocks.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_ENGINE_HH
+#define _BAYESIAN_BLOCKS_ENGINE_HH
+
+namespace BayesianBlocks {
+
+    // Bayesian blocks of a dataset that grows over time. The sorted data, the
+    // cumulative weights and the state of the recursion are kept between
+    // calls, so appending observations only costs the steps of the new points.
+    //
+    // The prior on the number of change points depends on the size of the
+    // dataset: it is calibrated once on n_calib distinct values and kept fixed,
+    // otherwise every step would have to be redone at each append. When
+    // n_calib is the final number of distinct values the change points are
+    // the same as the ones of blocks() on the whole dataset
+    class Engine {
+
+        public:
+
+        Engine(const double p, std::size_t n_calib, const bb::options& opts = bb::options());
+
+        // append observations, which must all be larger than the current maximum
+        void append(bb::data_array data, bb::weights_array weights);
+        // same with unit weights, repeated values are merged
+        void append(bb::data_array data);
+
+        // current change points, O(number of blocks). The steps skipped by
+        // a cancelled append are done first
+        bb::array change_points();
+
+        // number of distinct values so far
+        std::size_t size() const { return x.size(); }
+        double ncp_prior() const { return ncp; }
+        const bb::stats& report() const { return dp.report; }
+
+        private:
+
+        double ncp;
+        bb::observer* observer;
+        detail::solver<double> dp;
+        bb::data_array x;
+        bb::array cumw;
+        bb::array edges;
+    };
+}
+
+#ifdef BAYESIAN_BLOCKS_DEFINITIONS
+namespace BayesianBlocks {
+
+    BAYESIAN_BLOCKS_INLINE Engine::Engine(const double p, std::size_t n_calib, const bb::options& opts) :
+        ncp(detail::ncp_prior(p, n_calib)),
+        observer(opts.observer),
+        dp(opts, ncp),
+        cumw(1, 0.) {
+
+        if (n_calib == 0) {
+            throw std::invalid_argument("ERROR: the prior must be calibrated on at least one value");
+        }
+    }
+
+    BAYESIAN_BLOCKS_INLINE void Engine::append(bb::data_array data, bb::weights_array weights) {
+
+        // sanity checks
+        if (data.size() != weights.size()) {
+            throw std::domain_error("ERROR: data and weights vectors are of different sizes");
+        }
+
+        if (data.size() == 0) return;
+
+        if (std::find_if(weights.begin(), weights.end(),
+                         [](int& v) { return v <= 0; }) != weights.end()) {
+            throw std::domain_error("ERROR: invalid weights found in input");
+        }
+
+        if (std::find_if(data.begin(), data.end(), [](double v) { return std::isnan(v); }) != data.end()) {
+            throw std::domain_error("ERROR: invalid values found in input");
+        }
+
+        const auto n = data.size();
+        std::vector<std::size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(),
+                  [&data](std::size_t a, std::size_t b) { return data[a] < data[b]; });
+
+        // all checks come before the state is touched: a failed call leaves
+        // the engine as it was
+        if (!x.empty() and data[order[0]] <= x.back()) {
+            throw std::invalid_argument("ERROR: appended values must be larger than the current maximum");
+        }
+        for (std::size_t i = 1; i < n; ++i) {
+            if (data[order[i]] == data[order[i-1]]) {
+                throw std::invalid_argument("ERROR: duplicated values found in input");
+            }
+        }
+
+        // the edges from the current maximum on, checked as in blocks()
+        bb::array sorted, tail;
+        sorted.reserve(n+1);
+        if (!x.empty()) sorted.push_back(x.back());
+        for (auto i : order) sorted.push_back(data[i]);
+        detail::midpoint_edges(sorted.data(), sorted.size(), tail);
+
+        const auto N_old = x.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            x.push_back(data[order[i]]);
+            cumw.push_back(cumw.back() + weights[order[i]]);
+        }
+
+        // the last edge was the old maximum, now it is a midpoint
+        const auto N = x.size();
+        edges.resize(N_old);
+        edges.insert(edges.end(), tail.begin() + (N_old > 0 ? 1 : 0), tail.end());
+
+        // all steps but the last one are final: the last depends on edges[N],
+        // which moves with the next append. If the observer stops the call, the
+        // missing steps are done by the next one
+        if (observer) observer->begin();
+        dp.advance(cumw.data(), edges.data(), N-1);
+    }
+
+    BAYESIAN_BLOCKS_INLINE void Engine::append(bb::data_array data) {
+
+        // compute weights
+        detail::sort(data.data(), static_cast<int*>(nullptr), data.size(), 1);
+        bb::weights_array weights;
+        detail::run_length_encode(data, weights);
+
+        this->append(std::move(data), std::move(weights));
+    }
+
+    BAYESIAN_BLOCKS_INLINE bb::array Engine::change_points() {
+
+        if (x.empty()) return bb::array();
+
+        const auto N = x.size();
+
+        // steps left over by an append stopped by the observer
+        if (dp.size() < N-1) {
+            if (observer) observer->begin();
+            dp.advance(cumw.data(), edges.data(), N-1);
+        }
+
+        // iteratively find the change points, the last step is evaluated on the fly
+        std::vector<std::size_t> cp(1, N);
+        for (auto i = dp.peek(cumw.data(), edges.data()).pos; i != 0; i = dp.last[i-1]) {
+            cp.push_back(i);
+        }
+        cp.push_back(0);
+
+        bb::array result(cp.size());
+        std::transform(cp.rbegin(), cp.rend(), result.begin(),
+                       [this](std::size_t pos) { return edges[pos]; });
+
+        return result;
+    }
+}
+#endif
+
+#endif
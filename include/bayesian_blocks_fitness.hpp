@@ -0,0 +1,127 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <cmath>
+#include <cstddef>
+
+#include "bayesian_blocks_simd.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_FITNESS_HH
+#define _BAYESIAN_BLOCKS_FITNESS_HH
+
+namespace BayesianBlocks {
+
+    // Fitness functions of Scargle et al. 2012, as policies the recursion is
+    // instantiated with. A policy provides
+    //
+    //   value(a, b):      fitness of a block from the differences a, b of the
+    //                     two cumulative arrays, in double precision and for
+    //                     the vector types of the SIMD kernels
+    //   ncp_prior(p, N):  prior on the number of change points for N cells
+    //                     and false positive rate p, with the sign of a
+    //                     fitness term
+    //   name():           identifies the policy in the keys of the edge cache
+    //   prunable:         whether the fitness is superadditive (splitting a
+    //                     block never lowers it), i.e. whether options::pruned
+    //                     gives the exact result
+    //
+    // The kernels call value() directly, it is inlined in the loop over the
+    // candidates
+    namespace fitness {
+
+        // Event data: a block of N events over a length T has the Cash
+        // fitness N log(N/T). a are the cumulative weights, b the edges
+        struct events {
+
+            static const char* name() { return "events"; }
+
+            static double value(double N, double T) {
+                // empty blocks (binned data) have zero fitness
+                return N > 0 ? N * std::log(N/T) : 0.;
+            }
+
+#ifdef BAYESIAN_BLOCKS_X86_SIMD
+            __attribute__((target("avx2,fma")))
+            static __m256d value(__m256d N, __m256d T) {
+                const auto F = _mm256_mul_pd(N, detail::log_avx2(_mm256_div_pd(N, T)));
+                return _mm256_and_pd(F, _mm256_cmp_pd(N, _mm256_setzero_pd(), _CMP_GT_OQ));
+            }
+
+            __attribute__((target("avx512f")))
+            static __m512d value(__m512d N, __m512d T) {
+                const auto full = _mm512_cmp_pd_mask(N, _mm512_setzero_pd(), _CMP_GT_OQ);
+                return _mm512_maskz_mul_pd(full, N, detail::log_avx512(_mm512_div_pd(N, T)));
+            }
+#endif
+
+            // calibrated on simulated event data (eq. 21)
+            static double ncp_prior(double p, std::size_t N) {
+                return std::log(73.53 * p * std::pow(N, -0.478)) - 4;
+            }
+
+            static const bool prunable = true;
+        };
+
+        // Binned data: the same Cash fitness, with the bin contents as weights
+        // and the bin edges as the only candidate change points. Blocks may
+        // be empty. The prior is the one of event data on the number of bins
+        struct binned : events {
+
+            static const char* name() { return "binned"; }
+        };
+
+        // Point measurements y_i with Gaussian errors sigma_i: a block has
+        // fitness b^2 / 2a, with a = sum 1/sigma_i^2 and b = sum y_i/sigma_i^2
+        // the two cumulative arrays (the Gaussian log-likelihood, constant
+        // terms dropped)
+        struct measurements {
+
+            static const char* name() { return "measurements"; }
+
+            static double value(double a, double b) {
+                return b*b / (2*a);
+            }
+
+#ifdef BAYESIAN_BLOCKS_X86_SIMD
+            __attribute__((target("avx2,fma")))
+            static __m256d value(__m256d a, __m256d b) {
+                return _mm256_div_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(_mm256_set1_pd(2.), a));
+            }
+
+            __attribute__((target("avx512f")))
+            static __m512d value(__m512d a, __m512d b) {
+                return _mm512_div_pd(_mm512_mul_pd(b, b), _mm512_mul_pd(_mm512_set1_pd(2.), a));
+            }
+#endif
+
+            // the fitness is the log-likelihood ratio, as for events. On
+            // simulated Gaussian noise the event data prior keeps the false
+            // positive rate at or below p, 1.32 + 0.577 log10(N) (Scargle et
+            // al., fitted on half of this fitness) lets many more through
+            static double ncp_prior(double p, std::size_t N) {
+                return events::ncp_prior(p, N);
+            }
+
+            static const bool prunable = true;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,379 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bayesian_blocks.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_IO_HH
+#define _BAYESIAN_BLOCKS_IO_HH
+
+namespace BayesianBlocks {
+
+    namespace bb {
+
+        // Values of a binary file of float64 numbers, little-endian (e.g.
+        // written with fwrite from a double array on x86 or ARM). The file is
+        // memory mapped and read in place, begin() and end() can be passed
+        // straight to blocks(). On big-endian hosts the values are swapped into
+        // a buffer instead
+        class raw_input;
+    }
+
+    // Values of a text file with one record per line, fields separated by
+    // commas, semicolons, tabs or spaces. column is the zero-based index of the
+    // field to read. Empty lines and lines starting with '#' are skipped, and
+    // so is a first line that does not hold a number in that column (a
+    // header). Numbers are parsed independently of the global locale, any
+    // other malformed record throws, with its line number
+    bb::array read_text(const std::string& filename, std::size_t column = 0);
+
+    // Same as above, with the weights read from weight_column of the same records
+    bb::array read_text(const std::string& filename, std::size_t column,
+                        std::size_t weight_column, bb::array& weights);
+
+    // Numbers of a comma separated list, e.g. the priors of a scan given on
+    // the command line. Blanks around the fields are ignored, an empty or
+    // malformed field throws std::invalid_argument
+    bb::array parse_list(const std::string& list);
+
+    namespace detail {
+
+        // Memory mapping of a whole file, read only
+        class mapped_file {
+
+            public:
+
+            explicit mapped_file(const std::string& filename) {
+                const auto fd = ::open(filename.c_str(), O_RDONLY);
+                if (fd < 0) throw std::runtime_error("ERROR: could not open " + filename);
+                struct stat st;
+                if (::fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    throw std::runtime_error("ERROR: could not stat " + filename);
+                }
+                bytes = st.st_size;
+                if (bytes > 0) {
+                    ptr = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (ptr == MAP_FAILED) ptr = nullptr;
+                }
+                ::close(fd);
+                if (bytes > 0 and !ptr) throw std::runtime_error("ERROR: could not map " + filename);
+                if (ptr) ::madvise(ptr, bytes, MADV_SEQUENTIAL);
+            }
+
+            ~mapped_file() { if (ptr) ::munmap(ptr, bytes); }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            const void* data() const { return ptr; }
+            std::size_t size() const { return bytes; }
+
+            // hand the pages holding the first end bytes back to the OS, they
+            // can be read again from the file
+            void release(std::size_t end) {
+                static const std::size_t page = ::sysconf(_SC_PAGESIZE);
+                end = std::min(end, bytes) / page * page;
+                if (end > 0) ::madvise(ptr, end, MADV_DONTNEED);
+            }
+
+            private:
+
+            void* ptr = nullptr;
+            std::size_t bytes = 0;
+        };
+
+        // Parse a number at the start of [first, last): optional sign, digits
+        // with an optional decimal point, optional exponent, or inf/nan. Returns
+        // the end of the number, first if there is none. Mantissas of up to
+        // 2^53 with a decimal exponent within ±22 are exact in a double, as are
+        // the powers of ten, so a single multiplication or division gives the
+        // correctly rounded result (Clinger 1990). Anything else, e.g. the 17
+        // significant digits printed by %.17g, is handed to strtod_l() with
+        // the "C" locale
+        inline const char* parse_double(const char* first, const char* last, double& value) {
+
+            static const double pow10[] = {
+                1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+
+            auto p = first;
+            bool negative = false;
+            if (p != last and (*p == '+' or *p == '-')) negative = *p++ == '-';
+
+            // mantissa, up to 19 significant digits, the ones past that only
+            // shift the exponent
+            std::uint64_t mantissa = 0;
+            int digits = 0, exponent = 0;
+            bool any = false, truncated = false;
+            for (; p != last and *p >= '0' and *p <= '9'; ++p) {
+                any = true;
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa != 0) ++digits;
+                }
+                else {
+                    ++exponent;
+                    truncated |= *p != '0';
+                }
+            }
+            if (p != last and *p == '.') {
+                for (++p; p != last and *p >= '0' and *p <= '9'; ++p) {
+                    any = true;
+                    if (digits < 19) {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        if (mantissa != 0) ++digits;
+                        --exponent;
+                    }
+                    else truncated |= *p != '0';
+                }
+            }
+
+            if (!any) {
+                // inf, infinity, nan, in any case
+                auto match = [&](const char* word) {
+                    const auto n = std::strlen(word);
+                    if (static_cast<std::size_t>(last - p) < n) return false;
+                    for (std::size_t i = 0; i < n; ++i) {
+                        if ((p[i] | 0x20) != word[i]) return false;
+                    }
+                    p += n;
+                    return true;
+                };
+                if (match("infinity") or match("inf")) {
+                    value = negative ? -std::numeric_limits<double>::infinity()
+                                     : std::numeric_limits<double>::infinity();
+                    return p;
+                }
+                if (match("nan")) {
+                    value = std::numeric_limits<double>::quiet_NaN();
+                    return p;
+                }
+                return first;
+            }
+
+            // the exponent, left alone if no digit follows the 'e'
+            if (p != last and (*p == 'e' or *p == 'E')) {
+                auto q = p + 1;
+                bool negative_exponent = false;
+                if (q != last and (*q == '+' or *q == '-')) negative_exponent = *q++ == '-';
+                if (q != last and *q >= '0' and *q <= '9') {
+                    int e = 0;
+                    for (; q != last and *q >= '0' and *q <= '9'; ++q) {
+                        if (e < 100000) e = e * 10 + (*q - '0');
+                    }
+                    exponent += negative_exponent ? -e : e;
+                    p = q;
+                }
+            }
+
+            if (!truncated and mantissa <= (std::uint64_t(1) << 53) and exponent >= -22 and exponent <= 22) {
+                value = static_cast<double>(mantissa);
+                value = exponent < 0 ? value / pow10[-exponent] : value * pow10[exponent];
+                if (negative) value = -value;
+                return p;
+            }
+
+            // slow path, correctly rounded by the C library in the "C" locale
+            static const locale_t c_locale = ::newlocale(LC_ALL_MASK, "C", locale_t(0));
+            char buffer[64];
+            std::string long_number;
+            const auto n = static_cast<std::size_t>(p - first);
+            char* number = buffer;
+            if (n < sizeof(buffer)) std::memcpy(buffer, first, n);
+            else {
+                long_number.assign(first, p);
+                number = &long_number[0];
+            }
+            number[n] = '\0';
+            value = ::strtod_l(number, nullptr, c_locale);
+            return p;
+        }
+
+        inline bool is_blank(char c) { return c == ' ' or c == '\t' or c == '\r'; }
+        inline bool is_separator(char c) { return c == ',' or c == ';' or is_blank(c); }
+
+        // read the given columns of each record of a text file, see read_text()
+        inline void read_columns(const std::string& filename, const std::vector<std::size_t>& columns,
+                                 std::vector<bb::array*>& out) {
+
+            mapped_file input(filename);
+            const auto begin = static_cast<const char*>(input.data());
+            const auto end = begin + input.size();
+
+            // records of n bytes take at least two, a guess to skip most reallocations
+            for (auto o : out) o->reserve(input.size() / 16);
+
+            std::size_t max_column = 0;
+            for (auto c : columns) max_column = std::max(max_column, c);
+
+            std::vector<double> record(columns.size());
+            std::size_t line = 0;
+            bool first_record = true;
+            for (auto p = begin; p < end; ) {
+                ++line;
+                auto eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                if (!eol) eol = end;
+
+                // leading blanks, empty lines and comments
+                auto q = p;
+                while (q != eol and is_blank(*q)) ++q;
+                if (q == eol or *q == '#') {
+                    p = eol + 1;
+                    continue;
+                }
+
+                // walk the fields up to the last requested one
+                std::size_t found = 0;
+                bool bad = false;
+                for (std::size_t field = 0; field <= max_column and q != eol; ++field) {
+                    auto field_end = q;
+                    while (field_end != eol and !is_separator(*field_end)) ++field_end;
+                    for (std::size_t i = 0; i < columns.size(); ++i) {
+                        if (columns[i] != field) continue;
+                        if (detail::parse_double(q, field_end, record[i]) != field_end or q == field_end) bad = true;
+                        ++found;
+                    }
+                    // a comma or semicolon ends a field, runs of blanks around it are one separator
+                    q = field_end;
+                    while (q != eol and is_blank(*q)) ++q;
+                    if (q != eol and (*q == ',' or *q == ';')) {
+                        ++q;
+                        while (q != eol and is_blank(*q)) ++q;
+                    }
+                }
+                if (found != columns.size()) bad = true;
+
+                if (bad) {
+                    if (first_record) {
+                        first_record = false;
+                        p = eol + 1;
+                        continue;
+                    }
+                    throw std::runtime_error("ERROR: " + filename + ":" + std::to_string(line)
+                                             + ": could not read a number in column "
+                                             + std::to_string(max_column));
+                }
+                first_record = false;
+                for (std::size_t i = 0; i < columns.size(); ++i) out[i]->push_back(record[i]);
+                p = eol + 1;
+            }
+        }
+    }
+
+    namespace bb {
+
+        class raw_input {
+
+            public:
+
+            explicit raw_input(const std::string& filename) : file(filename) {
+                if (file.size() % sizeof(double) != 0) {
+                    throw std::invalid_argument("ERROR: size of " + filename + " is not a multiple of 8 bytes");
+                }
+                n = file.size() / sizeof(double);
+                ptr = static_cast<const double*>(file.data());
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                swapped.resize(n);
+                const auto bytes = static_cast<const unsigned char*>(file.data());
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::uint64_t u = 0;
+                    for (int b = 7; b >= 0; --b) u = u << 8 | bytes[8*i + b];
+                    std::memcpy(&swapped[i], &u, sizeof(u));
+                }
+                ptr = swapped.data();
+#endif
+            }
+
+            raw_input(const raw_input&) = delete;
+            raw_input& operator=(const raw_input&) = delete;
+
+            const double* begin() const { return ptr; }
+            const double* end() const { return ptr + n; }
+            const double* data() const { return ptr; }
+            std::size_t size() const { return n; }
+            bool empty() const { return n == 0; }
+
+            private:
+
+            detail::mapped_file file;
+            const double* ptr = nullptr;
+            std::size_t n = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            std::vector<double> swapped;
+#endif
+        };
+    }
+
+#ifdef BAYESIAN_BLOCKS_DEFINITIONS
+    BAYESIAN_BLOCKS_INLINE bb::array read_text(const std::string& filename, std::size_t column) {
+        bb::array values;
+        std::vector<bb::array*> out = {&values};
+        detail::read_columns(filename, {column}, out);
+        return values;
+    }
+
+    BAYESIAN_BLOCKS_INLINE bb::array read_text(const std::string& filename, std::size_t column,
+                                               std::size_t weight_column, bb::array& weights) {
+        bb::array values;
+        weights.clear();
+        std::vector<bb::array*> out = {&values, &weights};
+        detail::read_columns(filename, {column, weight_column}, out);
+        return values;
+    }
+
+    BAYESIAN_BLOCKS_INLINE bb::array parse_list(const std::string& list) {
+        bb::array values;
+        std::size_t pos = 0;
+        while (pos <= list.size()) {
+            const auto end = std::min(list.find(',', pos), list.size());
+            const char* first = list.data() + pos;
+            const char* last  = list.data() + end;
+            while (first != last and detail::is_blank(*first)) ++first;
+            while (last != first and detail::is_blank(*(last-1))) --last;
+            double value = 0;
+            if (first == last or detail::parse_double(first, last, value) != last) {
+                throw std::invalid_argument("ERROR: invalid list of numbers '" + list + "'");
+            }
+            values.push_back(value);
+            pos = end + 1;
+        }
+        return values;
+    }
+#endif
+}
+
+#endif
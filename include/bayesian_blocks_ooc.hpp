@@ -0,0 +1,239 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bayesian_blocks.hpp"
+#include "bayesian_blocks_io.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_OOC_HH
+#define _BAYESIAN_BLOCKS_OOC_HH
+
+namespace BayesianBlocks {
+
+    // Out-of-core mode, for inputs that do not fit in memory. The input is a
+    // binary file of sorted float64 values in native byte order (e.g. written
+    // with fwrite from a double array), repeated values are counted as
+    // weights. The file is memory mapped and read in two sequential passes.
+    //
+    // Cumulative weights, edges and the state of the recursion live in memory
+    // mappings: anonymous ones, or unlinked files in scratch_dir if not empty.
+    // File-backed pages behind the current step are handed back to the OS, so
+    // that with opts.pruned the resident memory is bounded by the alive
+    // candidates. Indices are stored in 32 bits, up to 2^32-1 distinct values.
+    // The edge cache is not used in this mode
+    bb::array blocks_mmap(const std::string& filename, const double p, const bb::options& opts,
+                          const std::string& scratch_dir = "",
+                          bool counter = false, bool benchmark = false);
+
+    bb::array blocks_mmap(const std::string& filename, const double p = 0.01,
+                          bool counter = false, bool benchmark = false);
+
+    namespace detail {
+
+        // Fixed capacity array in an anonymous memory mapping, or in one of an
+        // unlinked scratch file in dir. Same interface as std::vector, as far
+        // as the solver is concerned
+        template <typename V>
+        class mapped_vector {
+
+            public:
+
+            mapped_vector() {}
+
+            mapped_vector(std::size_t capacity, const std::string& dir) : cap(capacity) {
+                const auto bytes = std::max<std::size_t>(cap, 1) * sizeof(V);
+                if (dir.empty()) {
+                    ptr = static_cast<V*>(::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+                }
+                else {
+                    auto name = dir + "/bb-scratch-XXXXXX";
+                    const auto fd = ::mkstemp(&name[0]);
+                    if (fd < 0) throw std::runtime_error("ERROR: could not create scratch file in " + dir);
+                    ::unlink(name.c_str());
+                    if (::ftruncate(fd, bytes) == 0) {
+                        ptr = static_cast<V*>(::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED, fd, 0));
+                    }
+                    ::close(fd);
+                    file_backed = true;
+                }
+                if (ptr == MAP_FAILED or !ptr) {
+                    ptr = nullptr;
+                    throw std::runtime_error("ERROR: could not map scratch memory");
+                }
+            }
+
+            mapped_vector(mapped_vector&& o) { this->swap(o); }
+            mapped_vector& operator=(mapped_vector&& o) { this->swap(o); return *this; }
+            mapped_vector(const mapped_vector&) = delete;
+            mapped_vector& operator=(const mapped_vector&) = delete;
+
+            ~mapped_vector() {
+                if (ptr) ::munmap(ptr, std::max<std::size_t>(cap, 1) * sizeof(V));
+            }
+
+            void reserve(std::size_t n) {
+                if (n > cap) throw std::length_error("ERROR: mapped array capacity exceeded");
+            }
+            void push_back(const V& v) { ptr[n++] = v; }
+
+            V* data() { return ptr; }
+            const V* data() const { return ptr; }
+            std::size_t size() const { return n; }
+            V& operator[](std::size_t i) { return ptr[i]; }
+            const V& operator[](std::size_t i) const { return ptr[i]; }
+
+            // hand the pages holding [0, end) back to the OS. They are written
+            // to the scratch file and read again if needed, so this is a no-op
+            // for anonymous memory
+            void release(std::size_t end) {
+                if (!file_backed) return;
+                static const std::size_t page = ::sysconf(_SC_PAGESIZE);
+                const auto bytes = end * sizeof(V) / page * page;
+                if (bytes > 0) ::madvise(ptr, bytes, MADV_DONTNEED);
+            }
+
+            private:
+
+            void swap(mapped_vector& o) {
+                std::swap(ptr, o.ptr);
+                std::swap(cap, o.cap);
+                std::swap(n, o.n);
+                std::swap(file_backed, o.file_backed);
+            }
+
+            V* ptr = nullptr;
+            std::size_t cap = 0, n = 0;
+            bool file_backed = false;
+        };
+    }
+}
+
+#ifdef BAYESIAN_BLOCKS_DEFINITIONS
+namespace BayesianBlocks {
+
+    BAYESIAN_BLOCKS_INLINE bb::array blocks_mmap(const std::string& filename, const double p, const bb::options& opts,
+                                                 const std::string& scratch_dir, bool counter, bool benchmark) {
+
+        // legacy flags, printed by an observer
+        if (counter or benchmark) {
+            bb::stream_observer stream(counter, benchmark, opts.observer);
+            auto o = opts;
+            o.observer = &stream;
+            return BayesianBlocks::blocks_mmap(filename, p, o, scratch_dir);
+        }
+
+        if (opts.observer) opts.observer->begin();
+        detail::phase_timer timer(opts.observer);
+
+        detail::mapped_file input(filename);
+        const auto v = static_cast<const double*>(input.data());
+        const auto n = input.size() / sizeof(double);
+
+        if (n == 0 or input.size() % sizeof(double) != 0) {
+            throw std::invalid_argument("ERROR: input file must hold a non-empty array of float64 values");
+        }
+
+        // first pass: the input must be sorted, count the distinct values
+        std::size_t N = 1;
+        for (std::size_t i = 1; i < n; ++i) {
+            if (!(v[i-1] <= v[i])) {
+                throw std::invalid_argument("ERROR: input values must be sorted");
+            }
+            if (v[i] != v[i-1]) ++N;
+        }
+        if (N > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("ERROR: too many distinct values for the out-of-core mode");
+        }
+        timer.done(bb::phase::sort);
+
+        // second pass: cumulative weights of the distinct values and edges,
+        // the midpoints between consecutive values. Pages are released as
+        // they are done with
+        const std::size_t chunk = 1 << 20;
+        detail::mapped_vector<double> cumw(N+1, scratch_dir), edges(N+1, scratch_dir);
+        cumw.push_back(0);
+        edges.push_back(v[0]);
+        for (std::size_t i = 1, count = 1; i <= n; ++i, ++count) {
+            if (i < n and v[i] == v[i-1]) continue;
+            cumw.push_back(cumw[cumw.size()-1] + count);
+            edges.push_back(i < n ? (v[i-1] + v[i])/2. : v[n-1]);
+            count = 0;
+            if (cumw.size() % chunk == 0) {
+                input.release((i-1)*sizeof(double));
+                cumw.release(cumw.size());
+                edges.release(edges.size());
+            }
+        }
+        input.release(input.size());
+        cumw.release(cumw.size());
+        edges.release(edges.size());
+        timer.done(bb::phase::edges);
+
+        // the recursion, in chunks: after each one the pages of the steps that
+        // will not be read anymore are released
+        using index_array = detail::mapped_vector<std::uint32_t>;
+        using value_array = detail::mapped_vector<double>;
+        detail::solver<double, fitness::events, index_array, value_array> dp(
+            opts, detail::ncp_prior(p, N), index_array(N, scratch_dir), value_array(N+1, scratch_dir));
+
+        for (std::size_t k = std::min(N, chunk); ; k = std::min(N, k + chunk)) {
+            dp.advance(cumw.data(), edges.data(), k);
+            dp.last.release(k);
+            // alive candidates are copied by the pruned mode, the exhaustive
+            // one reads all past steps
+            if (opts.pruned) {
+                cumw.release(k);
+                edges.release(k);
+                dp.best.release(k);
+            }
+            if (k == N) break;
+        }
+        timer.done(bb::phase::loop);
+        if (opts.report) *opts.report = dp.report;
+        if (opts.observer) opts.observer->on_report(dp.report);
+
+        // iteratively find the change points
+        bb::array result;
+        for (std::size_t i = N; i != 0; i = dp.last[i-1]) result.push_back(edges[i]);
+        result.push_back(edges[0]);
+        std::reverse(result.begin(), result.end());
+        timer.done(bb::phase::backtrack);
+
+        return result;
+    }
+
+    BAYESIAN_BLOCKS_INLINE bb::array blocks_mmap(const std::string& filename, const double p, bool counter, bool benchmark) {
+        return BayesianBlocks::blocks_mmap(filename, p, bb::options(), "", counter, benchmark);
+    }
+}
+#endif
+
+#endif
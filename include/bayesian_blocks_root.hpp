@@ -17,7 +17,27 @@
 // IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 // CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#include <sstream>
+#include <limits>
+#include <locale>
+#include <string>
+#include <vector>
+
+#include "bayesian_blocks_config.hpp"
 #include "TH1.h"
+// only the definitions need the rest of ROOT, see bayesian_blocks_config.hpp
+#if defined(BAYESIAN_BLOCKS_DEFINITIONS) || defined(BAYESIAN_BLOCKS_ROOT_SOURCE)
+#include "TH1D.h"
+#include "TArrayD.h"
+#include "TArrayF.h"
+#include "TArrayI.h"
+#include "TArrayS.h"
+#include "TArrayC.h"
+#include "TROOT.h"
+#include "ROOT/RDataFrame.hxx"
+#else
+namespace ROOT { class RDataFrame; }
+#endif
 #include "bayesian_blocks.hpp"
 
 #ifndef _BAYESIAN_BLOCKS_ROOT_HH
@@ -25,66 +45,281 @@
 
 namespace BayesianBlocks {
 
-    // rebin a ROOT histogram
+    // rebin a ROOT histogram, bin centers are treated as unbinned events
+    TH1* rebin(TH1* h_in, const double p, const bb::options& opts,
+               bool counter = false, bool benchmark = false);
+
     TH1* rebin(TH1* h_in, const double p = 0.01,
                bool counter = false, bool benchmark = false);
+
+    // rebin a ROOT histogram as binned data: the new bin edges are chosen among
+    // the ones of the input histogram, whose contents are read in place
+    TH1* rebin_binned(TH1* h_in, const double p, const bb::options& opts,
+                      bool counter = false, bool benchmark = false);
+
+    TH1* rebin_binned(TH1* h_in, const double p = 0.01,
+                      bool counter = false, bool benchmark = false);
+
+    // prior scan: one rebinned histogram for each false positive rate in ps,
+    // named after the input with the suffix _b_p<value>, see blocks_scan()
+    std::vector<TH1*> rebin_scan(TH1* h_in, const std::vector<double>& ps,
+                                 const bb::options& opts = bb::options());
+
+    std::vector<TH1*> rebin_binned_scan(TH1* h_in, const std::vector<double>& ps,
+                                        const bb::options& opts = bb::options());
+
+    // Unbinned blocks of a numeric column (a branch or an expression of the
+    // branches) of a tree, read with RDataFrame. Each reader thread fills
+    // its own chunk of values, the chunks are sorted in parallel and merged,
+    // see blocks_chunks(). Returns a histogram with the blocks as bins,
+    // holding the event density, named <column>_b
+    TH1* blocks_tree(ROOT::RDataFrame& df, const std::string& column, const double p = 0.01,
+                     const bb::options& opts = bb::options());
+
+    // the same for the tree in a file. Implicit multi-threading is enabled
+    // with opts.threads threads, if not already
+    TH1* blocks_tree(const std::string& filename, const std::string& tree, const std::string& column,
+                     const double p = 0.01, const bb::options& opts = bb::options());
 }
 
+// compiled into libbayesianblocks_root with BAYESIAN_BLOCKS_COMPILED_LIB
+#if defined(BAYESIAN_BLOCKS_DEFINITIONS) || defined(BAYESIAN_BLOCKS_ROOT_SOURCE)
 namespace BayesianBlocks {
 
-    TH1* rebin(TH1* h_in, const double p, bool counter, bool benchmark) {
+    namespace detail {
+
+        // bin centers and contents of the non-empty bins of h_in
+        inline void unbinned_input(TH1* h_in, bb::data_array& x, bb::array& weights) {
+
+            if (h_in->GetDimension() != 1) {
+                throw std::invalid_argument("ERROR: only one-dimensional histograms are supported");
+            }
+
+            // fill arrays, skip empty bins
+            const auto Nb = h_in->GetNbinsX();
+            for (int i = 1; i < Nb; ++i ) {
+                auto c = h_in->GetBinContent(i);
+                if (c == 0) continue;
+                x      .push_back(h_in->GetBinCenter(i));
+                weights.push_back(c);
+            }
+        }
+
+        // histogram with the given edges, holding the contents of h_in
+        inline TH1* unbinned_output(TH1* h_in, const bb::array& result, const std::string& name) {
 
-        if (h_in->GetDimension() != 1) {
-            throw std::invalid_argument("ERROR: only one-dimensional histograms are supported");
+            auto h_out = new TH1D(name.c_str(), h_in->GetTitle(), result.size()-1, &result[0]);
+
+            for (int b = 1; b < h_in->GetNbinsX(); ++b) {
+                auto c = h_in->GetBinContent(b);
+                auto bin = h_out->FindBin(h_in->GetBinCenter(b));
+                h_out->SetBinContent(bin, h_out->GetBinContent(bin) + c);
+            }
+            h_out->SetBinContent(0, h_in->GetBinContent(0)); // underflow bin
+            h_out->SetBinContent(result.size(), h_in->GetBinContent(h_in->GetNbinsX())); // overflow bin
+            h_out->Scale(1, "width"); // make it a density by dividing contents and errors by bin widths
+
+            return h_out;
         }
 
-        // define variables
-        const auto Nb = h_in->GetNbinsX();
+        // name of the output of a prior scan, with the shortest decimal form
+        // of p that reads back as p: distinct priors get distinct names
+        inline std::string scan_name(TH1* h_in, double p) {
+            std::ostringstream value;
+            value.imbue(std::locale::classic());
+            for (int digits = 6; digits <= std::numeric_limits<double>::max_digits10; ++digits) {
+                value.str("");
+                value.precision(digits);
+                value << p;
+                std::istringstream in(value.str());
+                in.imbue(std::locale::classic());
+                double q = 0;
+                if (in >> q and q == p) break;
+            }
+            return std::string(h_in->GetName()) + "_b_p" + value.str();
+        }
+    }
+
+    BAYESIAN_BLOCKS_INLINE TH1* rebin(TH1* h_in, const double p, const bb::options& opts, bool counter, bool benchmark) {
+
+        // define variables, bin contents are used as (possibly fractional) weights
         bb::data_array x;
-        bb::weights_array weights;
-        bb::array edges;
-
-        // find first non-empty bin
-        int i_first = 1;
-        for (int i = 1; i < Nb; ++i ) {
-            if (h_in->GetBinContent(i) != 0) {
-                edges  .push_back(h_in->GetBinCenter(i));
-                x      .push_back(h_in->GetBinCenter(i));
-                weights.push_back(h_in->GetBinContent(i));
-                i_first = i;
-                break;
+        bb::array weights;
+        detail::unbinned_input(h_in, x, weights);
+
+        auto result = BayesianBlocks::blocks(x, weights, p, opts, counter, benchmark);
+
+        return detail::unbinned_output(h_in, result, std::string(h_in->GetName()) + "_b");
+    }
+
+    BAYESIAN_BLOCKS_INLINE std::vector<TH1*> rebin_scan(TH1* h_in, const std::vector<double>& ps, const bb::options& opts) {
+
+        bb::data_array x;
+        bb::array weights;
+        detail::unbinned_input(h_in, x, weights);
+
+        const auto results = BayesianBlocks::blocks_scan(x, weights, ps, opts);
+
+        std::vector<TH1*> h_out;
+        for (std::size_t j = 0; j < ps.size(); ++j) {
+            h_out.push_back(detail::unbinned_output(h_in, results[j], detail::scan_name(h_in, ps[j])));
+        }
+        return h_out;
+    }
+
+    BAYESIAN_BLOCKS_INLINE TH1* rebin(TH1* h_in, const double p, bool counter, bool benchmark) {
+        return BayesianBlocks::rebin(h_in, p, bb::options(), counter, benchmark);
+    }
+
+    namespace detail {
+
+        // sum the input bins [cp[j], cp[j+1]) into output bin j+1, in a single
+        // pass. Both arrays include the underflow and overflow bins
+        template <typename W>
+        void merge_bins(const W* in, const std::vector<std::size_t>& cp, double* out) {
+            const auto n_out = cp.size() - 1;
+            out[0] = in[0];
+            for (std::size_t j = 0; j < n_out; ++j) {
+                double sum = 0;
+                for (auto i = cp[j]; i < cp[j+1]; ++i) sum += in[i+1];
+                out[j+1] = sum;
+            }
+            out[n_out+1] = in[cp[n_out]+1];
+        }
+
+        // Rebin h_in as binned data, for each prior in ps: through
+        // blocks_binned() for a single one unless scan is set, which names the
+        // outputs after the prior
+        template <typename W>
+        std::vector<TH1*> rebin_binned(TH1* h_in, const W* contents, const std::vector<double>& ps,
+                                       const bb::options& opts, bool scan) {
+
+            const auto Nb = h_in->GetNbinsX();
+
+            // axis edges, stored only for variable binning
+            const double* edges = nullptr;
+            bb::array fixed_edges;
+            const auto xbins = h_in->GetXaxis()->GetXbins();
+            if (xbins->GetSize() == Nb+1) edges = xbins->GetArray();
+            else {
+                const auto xmin  = h_in->GetXaxis()->GetXmin();
+                const auto width = (h_in->GetXaxis()->GetXmax() - xmin)/Nb;
+                fixed_edges.resize(Nb+1);
+                for (int i = 0; i <= Nb; ++i) fixed_edges[i] = xmin + i*width;
+                edges = fixed_edges.data();
             }
+
+            // skip the underflow bin
+            std::vector<std::vector<std::size_t>> cps;
+            if (scan) cps = binned_partition_scan(edges, contents + 1, Nb, ps, opts);
+            else cps.push_back(binned_partition(edges, contents + 1, Nb, ps[0], opts));
+
+            std::vector<TH1*> hists;
+            for (std::size_t j = 0; j < cps.size(); ++j) {
+                const auto& cp = cps[j];
+                bb::array result(cp.size());
+                std::transform(cp.begin(), cp.end(), result.begin(),
+                               [edges](std::size_t pos) { return edges[pos]; });
+
+                auto h_out = new TH1D(
+                    (scan ? scan_name(h_in, ps[j]) : std::string(h_in->GetName()) + "_b").c_str(),
+                    h_in->GetTitle(), result.size()-1, &result[0]
+                );
+
+                // fill the output arrays directly, output edges are input edges
+                merge_bins(contents, cp, h_out->GetArray());
+                if (h_in->GetSumw2N() > 0) {
+                    h_out->Sumw2();
+                    merge_bins(h_in->GetSumw2()->GetArray(), cp, h_out->GetSumw2()->GetArray());
+                }
+                h_out->SetEntries(h_in->GetEntries());
+                h_out->Scale(1, "width"); // make it a density by dividing contents and errors by bin widths
+                hists.push_back(h_out);
+            }
+
+            return hists;
         }
 
-        // fill arrays, skip empty bins
-        for (int i = i_first+1; i < Nb; ++i ) {
-            auto c = h_in->GetBinContent(i);
-            if (floor(c) != ceil(c)) {
-                throw std::domain_error("ERROR: non-integer bin contents detected in input histogram");
+        BAYESIAN_BLOCKS_INLINE std::vector<TH1*> rebin_binned(TH1* h_in, const std::vector<double>& ps,
+                                                              const bb::options& opts, bool scan) {
+
+            if (h_in->GetDimension() != 1) {
+                throw std::invalid_argument("ERROR: only one-dimensional histograms are supported");
             }
-            if (c == 0) continue;
-            x      .push_back(h_in->GetBinCenter(i));
-            weights.push_back(c);
+
+            // fill the bin contents array if the histogram is buffered
+            h_in->BufferEmpty();
+
+            // read the bin contents in place, according to their storage type.
+            // Profiles store sums, not contents, so they go through GetBinContent
+            if (!h_in->InheritsFrom("TProfile")) {
+                if (auto a = dynamic_cast<TArrayD*>(h_in)) return detail::rebin_binned(h_in, a->GetArray(), ps, opts, scan);
+                if (auto a = dynamic_cast<TArrayF*>(h_in)) return detail::rebin_binned(h_in, a->GetArray(), ps, opts, scan);
+                if (auto a = dynamic_cast<TArrayI*>(h_in)) return detail::rebin_binned(h_in, a->GetArray(), ps, opts, scan);
+                if (auto a = dynamic_cast<TArrayS*>(h_in)) return detail::rebin_binned(h_in, a->GetArray(), ps, opts, scan);
+                if (auto a = dynamic_cast<TArrayC*>(h_in)) return detail::rebin_binned(h_in, a->GetArray(), ps, opts, scan);
+            }
+
+            bb::array contents(h_in->GetNbinsX()+2);
+            for (std::size_t i = 0; i < contents.size(); ++i) contents[i] = h_in->GetBinContent(i);
+            return detail::rebin_binned(h_in, contents.data(), ps, opts, scan);
         }
+    }
+
+    BAYESIAN_BLOCKS_INLINE TH1* rebin_binned(TH1* h_in, const double p, const bb::options& opts, bool counter, bool benchmark) {
+
+        // legacy flags, printed by an observer
+        if (counter or benchmark) {
+            bb::stream_observer stream(counter, benchmark, opts.observer);
+            auto o = opts;
+            o.observer = &stream;
+            return BayesianBlocks::rebin_binned(h_in, p, o);
+        }
+
+        return detail::rebin_binned(h_in, { p }, opts, false)[0];
+    }
+
+    BAYESIAN_BLOCKS_INLINE std::vector<TH1*> rebin_binned_scan(TH1* h_in, const std::vector<double>& ps, const bb::options& opts) {
+        return detail::rebin_binned(h_in, ps, opts, true);
+    }
 
-        auto result = BayesianBlocks::blocks(x, weights, p, counter, benchmark);
+    BAYESIAN_BLOCKS_INLINE TH1* blocks_tree(ROOT::RDataFrame& df, const std::string& column, const double p,
+                                            const bb::options& opts) {
 
-        auto h_out = new TH1D(
-            (std::string(h_in->GetName()) + "_b").c_str(), h_in->GetTitle(),
-            result.size()-1, &result[0]
-        );
+        // any numeric type, converted by a compiled expression
+        std::vector<std::vector<double>> chunks(df.GetNSlots());
+        auto values = df.Define("bb_value", "static_cast<double>(" + column + ")");
+        values.ForeachSlot([&chunks](unsigned slot, double v) { chunks[slot].push_back(v); },
+                           { "bb_value" });
 
-        for (int b = 1; b < h_in->GetNbinsX(); ++b) {
-            auto c = h_in->GetBinContent(b);
-            auto bin = h_out->FindBin(h_in->GetBinCenter(b));
-            h_out->SetBinContent(bin, h_out->GetBinContent(bin) + c);
+        bb::workspace<double> ws;
+        const auto& result = BayesianBlocks::blocks_chunks(chunks, p, ws, opts);
+
+        // the distinct values and their counts are still in ws, sorted
+        auto h_out = new TH1D((column + "_b").c_str(), column.c_str(), result.size()-1, &result[0]);
+        std::size_t n = 0;
+        for (std::size_t i = 0, b = 1; i < ws.x.size(); ++i) {
+            while (b < result.size()-1 and ws.x[i] >= result[b]) ++b;
+            h_out->SetBinContent(b, h_out->GetBinContent(b) + ws.w[i]);
+            n += ws.w[i];
         }
-        h_out->SetBinContent(0, h_in->GetBinContent(0)); // underflow bin
-        h_out->SetBinContent(result.size(), h_in->GetBinContent(h_in->GetNbinsX())); // overflow bin
+        h_out->SetEntries(n);
         h_out->Scale(1, "width"); // make it a density by dividing contents and errors by bin widths
 
         return h_out;
     }
+
+    BAYESIAN_BLOCKS_INLINE TH1* blocks_tree(const std::string& filename, const std::string& tree, const std::string& column,
+                                            const double p, const bb::options& opts) {
+        if (opts.threads != 1 and !ROOT::IsImplicitMTEnabled()) ROOT::EnableImplicitMT(opts.threads);
+        ROOT::RDataFrame df(tree, filename);
+        return BayesianBlocks::blocks_tree(df, column, p, opts);
+    }
+
+    BAYESIAN_BLOCKS_INLINE TH1* rebin_binned(TH1* h_in, const double p, bool counter, bool benchmark) {
+        return BayesianBlocks::rebin_binned(h_in, p, bb::options(), counter, benchmark);
+    }
 }
+#endif
 
 #endif
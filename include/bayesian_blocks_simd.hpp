@@ -0,0 +1,333 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include "bayesian_blocks_config.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) \
+    && !defined(BAYESIAN_BLOCKS_NO_SIMD)
+#define BAYESIAN_BLOCKS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifndef _BAYESIAN_BLOCKS_SIMD_HH
+#define _BAYESIAN_BLOCKS_SIMD_HH
+
+namespace BayesianBlocks {
+
+    namespace bb {
+        // instruction set used by the fitness kernel
+        enum class simd { automatic, scalar, avx2, avx512 };
+    }
+
+    // widest kernel supported by the running CPU
+    bb::simd simd_level();
+
+    namespace detail {
+
+        // result of a fused max/argmax reduction
+        struct argmax_t {
+            double value;
+            std::size_t pos;
+        };
+
+        // signature shared by all the kernels below. They evaluate
+        //
+        //   A[r] = F::value(W_k - W[r], E_k - E[r]) + ncp_prior + B[r]
+        //
+        // for r in [0, n) and return the first maximum of A, like std::max_element.
+        // F is the fitness policy (see bayesian_blocks_fitness.hpp), W and E the
+        // two cumulative arrays it takes (for event data the weights and the
+        // bin edges) and B the (shifted) best fitness array. If A is not null
+        // the values are stored there too. E keeps the precision of the input
+        // bin edges (float or double), the fitness is always computed in
+        // double precision. Event data always has double edges, see
+        // midpoint_edges()
+        template <typename T>
+        using argmax_kernel = argmax_t (*)(const double* W, const T* E, const double* B,
+                                           std::size_t n, double W_k, double E_k, double ncp_prior,
+                                           double* A);
+
+        template <typename F, typename T>
+        inline argmax_t argmax_scalar(const double* W, const T* E, const double* B,
+                                      std::size_t n, double W_k, double E_k, double ncp_prior,
+                                      double* A) {
+            argmax_t res = { -std::numeric_limits<double>::infinity(), 0 };
+            for (std::size_t r = 0; r < n; ++r) {
+                const auto F_r = F::value(W_k - W[r], E_k - static_cast<double>(E[r]));
+                const auto A_r = F_r + ncp_prior + B[r];
+                if (A) A[r] = A_r;
+                if (A_r > res.value) {
+                    res.value = A_r;
+                    res.pos   = r;
+                }
+            }
+            return res;
+        }
+
+#ifdef BAYESIAN_BLOCKS_X86_SIMD
+
+        // Cephes rational approximation of log(1+x) for sqrt(1/2)-1 <= x < sqrt(2)-1,
+        // accurate to about one ulp in double precision
+        namespace logc {
+            const double P0 = 7.70838733755885391666E0;
+            const double P1 = 1.79368678507819816313E1;
+            const double P2 = 1.44989225341610930846E1;
+            const double P3 = 4.70579119878881725854E0;
+            const double P4 = 4.97494994976747001425E-1;
+            const double P5 = 1.01875663804580931796E-4;
+            const double Q0 = 2.31251620126765340583E1;
+            const double Q1 = 7.11544750618563894466E1;
+            const double Q2 = 8.29875266912776603211E1;
+            const double Q3 = 4.52279145837532221105E1;
+            const double Q4 = 1.12873587189167450590E1;
+            const double ln2_hi = 0.693359375;
+            const double ln2_lo = -2.121944400546905827679E-4;
+            const double sqrth  = 0.70710678118654752440;
+        }
+
+        // load four edges as doubles
+        __attribute__((target("avx2,fma")))
+        inline __m256d load_avx2(const double* E) { return _mm256_loadu_pd(E); }
+
+        __attribute__((target("avx2,fma")))
+        inline __m256d load_avx2(const float* E) { return _mm256_cvtps_pd(_mm_loadu_ps(E)); }
+
+        // log(x) for positive, normal x
+        __attribute__((target("avx2,fma")))
+        inline __m256d log_avx2(__m256d x) {
+            // split x = m * 2^e with m in [0.5, 1)
+            const auto bits  = _mm256_castpd_si256(x);
+            const auto mbits = _mm256_or_si256(
+                _mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+                _mm256_set1_epi64x(0x3FE0000000000000LL));
+            auto m = _mm256_castsi256_pd(mbits);
+            // biased exponent to double, through the 2^52 magic number
+            const auto ebits = _mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                                               _mm256_set1_epi64x(0x4330000000000000LL));
+            auto e = _mm256_sub_pd(_mm256_castsi256_pd(ebits),
+                                   _mm256_set1_pd(4503599627370496. + 1022.));
+
+            // move m into [sqrt(1/2), sqrt(2)) and take m-1
+            const auto small = _mm256_cmp_pd(m, _mm256_set1_pd(logc::sqrth), _CMP_LT_OQ);
+            const auto one   = _mm256_set1_pd(1.);
+            e = _mm256_sub_pd(e, _mm256_and_pd(small, one));
+            m = _mm256_sub_pd(_mm256_add_pd(m, _mm256_and_pd(small, m)), one);
+
+            const auto z = _mm256_mul_pd(m, m);
+            auto P = _mm256_fmadd_pd(_mm256_set1_pd(logc::P5), m, _mm256_set1_pd(logc::P4));
+            P = _mm256_fmadd_pd(P, m, _mm256_set1_pd(logc::P3));
+            P = _mm256_fmadd_pd(P, m, _mm256_set1_pd(logc::P2));
+            P = _mm256_fmadd_pd(P, m, _mm256_set1_pd(logc::P1));
+            P = _mm256_fmadd_pd(P, m, _mm256_set1_pd(logc::P0));
+            auto Q = _mm256_add_pd(m, _mm256_set1_pd(logc::Q4));
+            Q = _mm256_fmadd_pd(Q, m, _mm256_set1_pd(logc::Q3));
+            Q = _mm256_fmadd_pd(Q, m, _mm256_set1_pd(logc::Q2));
+            Q = _mm256_fmadd_pd(Q, m, _mm256_set1_pd(logc::Q1));
+            Q = _mm256_fmadd_pd(Q, m, _mm256_set1_pd(logc::Q0));
+
+            auto y = _mm256_mul_pd(_mm256_mul_pd(m, z), _mm256_div_pd(P, Q));
+            y = _mm256_fmadd_pd(e, _mm256_set1_pd(logc::ln2_lo), y);
+            y = _mm256_fnmadd_pd(z, _mm256_set1_pd(0.5), y);
+            return _mm256_fmadd_pd(e, _mm256_set1_pd(logc::ln2_hi), _mm256_add_pd(m, y));
+        }
+
+        template <typename F, typename T>
+        __attribute__((target("avx2,fma")))
+        inline argmax_t argmax_avx2(const double* W, const T* E, const double* B,
+                                         std::size_t n, double W_k, double E_k, double ncp_prior,
+                                         double* A) {
+            const auto vW_k = _mm256_set1_pd(W_k);
+            const auto vE_k = _mm256_set1_pd(E_k);
+            const auto vncp = _mm256_set1_pd(ncp_prior);
+            const auto step = _mm256_set1_pd(4.);
+            // candidate indices are carried as doubles, exact up to 2^53
+            auto idx  = _mm256_set_pd(3., 2., 1., 0.);
+            auto vmax = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+            auto vpos = _mm256_setzero_pd();
+
+            std::size_t r = 0;
+            for (; r + 4 <= n; r += 4) {
+                const auto W_r = _mm256_sub_pd(vW_k, _mm256_loadu_pd(W + r));
+                const auto E_r = _mm256_sub_pd(vE_k, load_avx2(E + r));
+                auto vA = F::value(W_r, E_r);
+                vA = _mm256_add_pd(_mm256_add_pd(vA, vncp), _mm256_loadu_pd(B + r));
+                if (A) _mm256_storeu_pd(A + r, vA);
+                // strict comparison: each lane keeps its first maximum
+                const auto gt = _mm256_cmp_pd(vA, vmax, _CMP_GT_OQ);
+                vmax = _mm256_blendv_pd(vmax, vA, gt);
+                vpos = _mm256_blendv_pd(vpos, idx, gt);
+                idx  = _mm256_add_pd(idx, step);
+            }
+
+            // horizontal reduction, ties go to the lowest index
+            alignas(32) double lmax[4], lpos[4];
+            _mm256_store_pd(lmax, vmax);
+            _mm256_store_pd(lpos, vpos);
+            argmax_t res = { lmax[0], static_cast<std::size_t>(lpos[0]) };
+            for (int l = 1; l < 4; ++l) {
+                const auto pos = static_cast<std::size_t>(lpos[l]);
+                if (lmax[l] > res.value or (lmax[l] == res.value and pos < res.pos)) {
+                    res.value = lmax[l];
+                    res.pos   = pos;
+                }
+            }
+
+            // remainder, always at higher indices
+            if (r < n) {
+                auto tail = argmax_scalar<F>(W + r, E + r, B + r, n - r, W_k, E_k, ncp_prior,
+                                               A ? A + r : nullptr);
+                if (tail.value > res.value) {
+                    res.value = tail.value;
+                    res.pos   = tail.pos + r;
+                }
+            }
+            return res;
+        }
+
+        // load eight edges as doubles
+        __attribute__((target("avx512f")))
+        inline __m512d load_avx512(const double* E) { return _mm512_loadu_pd(E); }
+
+        __attribute__((target("avx512f")))
+        inline __m512d load_avx512(const float* E) { return _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(E)); }
+
+        // log(x) for positive, normal x
+        __attribute__((target("avx512f")))
+        inline __m512d log_avx512(__m512d x) {
+            // split x = m * 2^e with m in [0.5, 1). The zero-masked variants
+            // avoid spurious -Wuninitialized warnings on GCC
+            auto m = _mm512_maskz_getmant_pd(0xFF, x, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_src);
+            auto e = _mm512_add_pd(_mm512_maskz_getexp_pd(0xFF, x), _mm512_set1_pd(1.));
+
+            // move m into [sqrt(1/2), sqrt(2)) and take m-1
+            const auto small = _mm512_cmp_pd_mask(m, _mm512_set1_pd(logc::sqrth), _CMP_LT_OQ);
+            const auto one   = _mm512_set1_pd(1.);
+            e = _mm512_mask_sub_pd(e, small, e, one);
+            m = _mm512_sub_pd(_mm512_mask_add_pd(m, small, m, m), one);
+
+            const auto z = _mm512_mul_pd(m, m);
+            auto P = _mm512_fmadd_pd(_mm512_set1_pd(logc::P5), m, _mm512_set1_pd(logc::P4));
+            P = _mm512_fmadd_pd(P, m, _mm512_set1_pd(logc::P3));
+            P = _mm512_fmadd_pd(P, m, _mm512_set1_pd(logc::P2));
+            P = _mm512_fmadd_pd(P, m, _mm512_set1_pd(logc::P1));
+            P = _mm512_fmadd_pd(P, m, _mm512_set1_pd(logc::P0));
+            auto Q = _mm512_add_pd(m, _mm512_set1_pd(logc::Q4));
+            Q = _mm512_fmadd_pd(Q, m, _mm512_set1_pd(logc::Q3));
+            Q = _mm512_fmadd_pd(Q, m, _mm512_set1_pd(logc::Q2));
+            Q = _mm512_fmadd_pd(Q, m, _mm512_set1_pd(logc::Q1));
+            Q = _mm512_fmadd_pd(Q, m, _mm512_set1_pd(logc::Q0));
+
+            auto y = _mm512_mul_pd(_mm512_mul_pd(m, z), _mm512_div_pd(P, Q));
+            y = _mm512_fmadd_pd(e, _mm512_set1_pd(logc::ln2_lo), y);
+            y = _mm512_fnmadd_pd(z, _mm512_set1_pd(0.5), y);
+            return _mm512_fmadd_pd(e, _mm512_set1_pd(logc::ln2_hi), _mm512_add_pd(m, y));
+        }
+
+        template <typename F, typename T>
+        __attribute__((target("avx512f")))
+        inline argmax_t argmax_avx512(const double* W, const T* E, const double* B,
+                                           std::size_t n, double W_k, double E_k, double ncp_prior,
+                                           double* A) {
+            const auto vW_k = _mm512_set1_pd(W_k);
+            const auto vE_k = _mm512_set1_pd(E_k);
+            const auto vncp = _mm512_set1_pd(ncp_prior);
+            const auto step = _mm512_set1_pd(8.);
+            // candidate indices are carried as doubles, exact up to 2^53
+            auto idx  = _mm512_set_pd(7., 6., 5., 4., 3., 2., 1., 0.);
+            auto vmax = _mm512_set1_pd(-std::numeric_limits<double>::infinity());
+            auto vpos = _mm512_setzero_pd();
+
+            std::size_t r = 0;
+            for (; r + 8 <= n; r += 8) {
+                const auto W_r = _mm512_sub_pd(vW_k, _mm512_loadu_pd(W + r));
+                const auto E_r = _mm512_sub_pd(vE_k, load_avx512(E + r));
+                auto vA = F::value(W_r, E_r);
+                vA = _mm512_add_pd(_mm512_add_pd(vA, vncp), _mm512_loadu_pd(B + r));
+                if (A) _mm512_storeu_pd(A + r, vA);
+                // strict comparison: each lane keeps its first maximum
+                const auto gt = _mm512_cmp_pd_mask(vA, vmax, _CMP_GT_OQ);
+                vmax = _mm512_mask_blend_pd(gt, vmax, vA);
+                vpos = _mm512_mask_blend_pd(gt, vpos, idx);
+                idx  = _mm512_add_pd(idx, step);
+            }
+
+            // horizontal reduction, ties go to the lowest index
+            alignas(64) double lmax[8], lpos[8];
+            _mm512_store_pd(lmax, vmax);
+            _mm512_store_pd(lpos, vpos);
+            argmax_t res = { lmax[0], static_cast<std::size_t>(lpos[0]) };
+            for (int l = 1; l < 8; ++l) {
+                const auto pos = static_cast<std::size_t>(lpos[l]);
+                if (lmax[l] > res.value or (lmax[l] == res.value and pos < res.pos)) {
+                    res.value = lmax[l];
+                    res.pos   = pos;
+                }
+            }
+
+            // remainder, always at higher indices
+            if (r < n) {
+                auto tail = argmax_scalar<F>(W + r, E + r, B + r, n - r, W_k, E_k, ncp_prior,
+                                               A ? A + r : nullptr);
+                if (tail.value > res.value) {
+                    res.value = tail.value;
+                    res.pos   = tail.pos + r;
+                }
+            }
+            return res;
+        }
+
+#endif // BAYESIAN_BLOCKS_X86_SIMD
+
+        // pick the kernel for the requested instruction set, falling back to
+        // the widest one available at runtime
+        template <typename F, typename T>
+        argmax_kernel<T> select_kernel(bb::simd level) {
+            if (level == bb::simd::automatic) level = simd_level();
+#ifdef BAYESIAN_BLOCKS_X86_SIMD
+            if (level == bb::simd::avx512 and simd_level() == bb::simd::avx512) {
+                return argmax_avx512<F, T>;
+            }
+            if ((level == bb::simd::avx512 or level == bb::simd::avx2)
+                and simd_level() != bb::simd::scalar) {
+                return argmax_avx2<F, T>;
+            }
+#endif
+            return argmax_scalar<F, T>;
+        }
+    }
+}
+
+#ifdef BAYESIAN_BLOCKS_DEFINITIONS
+namespace BayesianBlocks {
+
+    BAYESIAN_BLOCKS_INLINE bb::simd simd_level() {
+#ifdef BAYESIAN_BLOCKS_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return bb::simd::avx512;
+        if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")) return bb::simd::avx2;
+#endif
+        return bb::simd::scalar;
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,255 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
+
+#include "bayesian_blocks_threads.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_SORT_HH
+#define _BAYESIAN_BLOCKS_SORT_HH
+
+namespace BayesianBlocks {
+
+    namespace detail {
+
+        // unsigned integer with the bit pattern of a floating point type
+        template <typename T> struct radix_key {};
+        template <> struct radix_key<float>  { using type = std::uint32_t; };
+        template <> struct radix_key<double> { using type = std::uint64_t; };
+
+        // IEEE-754 bits mapped to an unsigned integer with the same ordering:
+        // negative values have all bits flipped, positive ones the sign bit set
+        template <typename T>
+        inline typename radix_key<T>::type to_key(T v) {
+            using U = typename radix_key<T>::type;
+            U u;
+            std::memcpy(&u, &v, sizeof(T));
+            const U sign = U(1) << (8*sizeof(T) - 1);
+            return (u & sign) ? ~u : (u | sign);
+        }
+
+        // Stable LSD radix sort of x, one byte per pass, moving w (if not null)
+        // along. Passes where all the values share the same byte are skipped.
+        // x_buf and w_buf must hold n elements. Values must not be NaN
+        template <typename T, typename W>
+        void radix_sort(T* x, W* w, std::size_t n, T* x_buf, W* w_buf) {
+
+            constexpr std::size_t passes = sizeof(T);
+
+            // histograms of all the bytes in a single read
+            std::array<std::array<std::size_t, 256>, passes> count;
+            for (auto& c : count) c.fill(0);
+            for (std::size_t i = 0; i < n; ++i) {
+                const auto k = to_key(x[i]);
+                for (std::size_t p = 0; p < passes; ++p) ++count[p][(k >> 8*p) & 0xFF];
+            }
+
+            T* src_x = x;
+            T* dst_x = x_buf;
+            W* src_w = w;
+            W* dst_w = w_buf;
+            for (std::size_t p = 0; p < passes; ++p) {
+                auto& c = count[p];
+                if (n == 0 or c[(to_key(src_x[0]) >> 8*p) & 0xFF] == n) continue;
+
+                // exclusive prefix sums: first position of each byte value
+                std::size_t sum = 0;
+                for (auto& i : c) {
+                    const auto tmp = i;
+                    i = sum;
+                    sum += tmp;
+                }
+
+                for (std::size_t i = 0; i < n; ++i) {
+                    const auto pos = c[(to_key(src_x[i]) >> 8*p) & 0xFF]++;
+                    dst_x[pos] = src_x[i];
+                    if (w) dst_w[pos] = src_w[i];
+                }
+                std::swap(src_x, dst_x);
+                std::swap(src_w, dst_w);
+            }
+
+            if (src_x != x) {
+                std::copy(src_x, src_x + n, x);
+                if (w) std::copy(src_w, src_w + n, w);
+            }
+        }
+
+        // merge the sorted runs [a, b) and [b, c) of x (and w) into the buffers
+        template <typename T, typename W>
+        void merge_runs(const T* x, const W* w, std::size_t a, std::size_t b, std::size_t c,
+                        T* x_buf, W* w_buf) {
+            auto i = a, j = b, o = a;
+            while (i < b and j < c) {
+                // take from the left run on ties, the merge is stable
+                const bool left = !(to_key(x[j]) < to_key(x[i]));
+                const auto s = left ? i++ : j++;
+                x_buf[o] = x[s];
+                if (w) w_buf[o] = w[s];
+                ++o;
+            }
+            for (; i < b; ++i, ++o) { x_buf[o] = x[i]; if (w) w_buf[o] = w[i]; }
+            for (; j < c; ++j, ++o) { x_buf[o] = x[j]; if (w) w_buf[o] = w[j]; }
+        }
+
+        // other floating point types: comparison sort through an index permutation
+        template <typename T, typename W>
+        void sort(T* x, W* w, std::size_t n, unsigned, std::vector<T>&, std::vector<W>&,
+                  std::false_type) {
+            std::vector<std::size_t> order(n);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(),
+                             [x](std::size_t a, std::size_t b) { return x[a] < x[b]; });
+            std::vector<T> x_sorted(n);
+            for (std::size_t i = 0; i < n; ++i) x_sorted[i] = x[order[i]];
+            std::copy(x_sorted.begin(), x_sorted.end(), x);
+            if (!w) return;
+            std::vector<W> w_sorted(n);
+            for (std::size_t i = 0; i < n; ++i) w_sorted[i] = w[order[i]];
+            std::copy(w_sorted.begin(), w_sorted.end(), w);
+        }
+
+        // Sort the runs [bounds[i], bounds[i+1]) of x (and w along, if not
+        // null), spread over the threads of pool, then merge them pairwise,
+        // also in parallel. x_buf and w_buf are scratch space
+        template <typename T, typename W>
+        void sort_runs(T* x, W* w, const std::vector<std::size_t>& bounds, thread_pool& pool,
+                       std::vector<T>& x_buf, std::vector<W>& w_buf, std::true_type) {
+
+            const auto n = bounds.back();
+            const std::size_t n_runs = bounds.size() - 1;
+            x_buf.resize(n);
+            w_buf.resize(w ? n : 0);
+
+            auto sort_run = [&](unsigned t) {
+                for (std::size_t i = t; i < n_runs; i += pool.size()) {
+                    const auto a = bounds[i];
+                    radix_sort(x + a, w ? w + a : nullptr, bounds[i+1] - a,
+                               x_buf.data() + a, w ? w_buf.data() + a : nullptr);
+                }
+            };
+            pool.run(sort_run);
+
+            // merge rounds, runs of width chunks at a time
+            T* src_x = x;
+            T* dst_x = x_buf.data();
+            W* src_w = w;
+            W* dst_w = w ? w_buf.data() : nullptr;
+            for (std::size_t width = 1; width < n_runs; width *= 2) {
+                auto merge = [&](unsigned t) {
+                    for (std::size_t first = 2 * width * t; first < n_runs; first += 2 * width * pool.size()) {
+                        const auto mid  = std::min(first + width, n_runs);
+                        const auto last = std::min(first + 2*width, n_runs);
+                        merge_runs(src_x, src_w, bounds[first], bounds[mid], bounds[last], dst_x, dst_w);
+                    }
+                };
+                pool.run(merge);
+                std::swap(src_x, dst_x);
+                std::swap(src_w, dst_w);
+            }
+
+            if (src_x != x) {
+                std::copy(src_x, src_x + n, x);
+                if (w) std::copy(src_w, src_w + n, w);
+            }
+        }
+
+        // other floating point types: the runs are sorted as a whole
+        template <typename T, typename W>
+        void sort_runs(T* x, W* w, const std::vector<std::size_t>& bounds, thread_pool&,
+                       std::vector<T>& x_buf, std::vector<W>& w_buf, std::false_type) {
+            detail::sort(x, w, bounds.back(), 1, x_buf, w_buf, std::false_type());
+        }
+
+        // Sort x (and w along, if not null). Large inputs are split among
+        // n_threads threads, each one sorting a chunk, then the chunks are
+        // merged pairwise, also in parallel
+        template <typename T, typename W>
+        void sort(T* x, W* w, std::size_t n, unsigned n_threads,
+                  std::vector<T>& x_buf, std::vector<W>& w_buf, std::true_type) {
+
+            x_buf.resize(n);
+            w_buf.resize(w ? n : 0);
+
+            // below this size per thread, splitting does not pay off
+            const std::size_t min_chunk = 1 << 18;
+            n_threads = std::max(1u, std::min<unsigned>(n_threads, n / min_chunk));
+
+            if (n_threads == 1) {
+                radix_sort(x, w, n, x_buf.data(), w_buf.data());
+                return;
+            }
+
+            thread_pool pool(n_threads);
+            std::vector<std::size_t> bounds(n_threads + 1);
+            for (unsigned i = 0; i <= n_threads; ++i) bounds[i] = n * i / n_threads;
+            sort_runs(x, w, bounds, pool, x_buf, w_buf, std::true_type());
+        }
+
+        // x_buf and w_buf are scratch space, resized as needed: reusing them
+        // between serial calls avoids any allocation
+        template <typename T, typename W>
+        void sort(T* x, W* w, std::size_t n, unsigned n_threads,
+                  std::vector<T>& x_buf, std::vector<W>& w_buf) {
+            using radix = std::integral_constant<bool, std::is_same<T, float>::value or
+                                                       std::is_same<T, double>::value>;
+            detail::sort(x, w, n, n_threads, x_buf, w_buf, radix());
+        }
+
+        template <typename T, typename W>
+        void sort_runs(T* x, W* w, const std::vector<std::size_t>& bounds, thread_pool& pool,
+                       std::vector<T>& x_buf, std::vector<W>& w_buf) {
+            using radix = std::integral_constant<bool, std::is_same<T, float>::value or
+                                                       std::is_same<T, double>::value>;
+            detail::sort_runs(x, w, bounds, pool, x_buf, w_buf, radix());
+        }
+
+        template <typename T, typename W>
+        void sort(T* x, W* w, std::size_t n, unsigned n_threads) {
+            std::vector<T> x_buf;
+            std::vector<W> w_buf;
+            detail::sort(x, w, n, n_threads, x_buf, w_buf);
+        }
+
+        // Merge runs of equal values of the sorted x in place, counting them
+        // in w. x and w are resized to the number of distinct values
+        template <typename T, typename C>
+        void run_length_encode(std::vector<T>& x, std::vector<C>& w) {
+            w.resize(x.size());
+            std::size_t j = 0;
+            for (std::size_t i = 0; i < x.size(); ++j) {
+                auto k = i + 1;
+                while (k < x.size() and x[k] == x[i]) ++k;
+                x[j] = x[i];
+                w[j] = k - i;
+                i = k;
+            }
+            x.resize(j);
+            w.resize(j);
+        }
+    }
+}
+
+#endif
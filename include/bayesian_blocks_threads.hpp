@@ -0,0 +1,156 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
+#ifndef _BAYESIAN_BLOCKS_THREADS_HH
+#define _BAYESIAN_BLOCKS_THREADS_HH
+
+namespace BayesianBlocks {
+
+    namespace detail {
+
+        inline void cpu_relax() {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+            _mm_pause();
+#endif
+        }
+
+        // number of threads of a call, 0 means one per hardware thread
+        inline unsigned pool_size(unsigned threads) {
+            return threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // Fixed-size pool of worker threads for fork-join parallelism with a
+        // very short period: run() hands the same task to every thread and
+        // returns once all of them are done. Idle workers spin and yield for a
+        // while before going to sleep, so that back-to-back calls (one per step
+        // of the recursion) do not pay for a system call each
+        class thread_pool {
+
+            public:
+
+            // n threads in total, the calling one included
+            explicit thread_pool(unsigned n) :
+                n_threads(n == 0 ? 1 : n), generation(0), pending(0), stop(false) {
+                for (unsigned i = 1; i < n_threads; ++i) {
+                    workers.emplace_back([this, i]() { this->work(i); });
+                }
+            }
+
+            ~thread_pool() {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    stop = true;
+                    generation.fetch_add(1, std::memory_order_release);
+                }
+                cv.notify_all();
+                for (auto& t : workers) t.join();
+            }
+
+            thread_pool(const thread_pool&) = delete;
+            thread_pool& operator=(const thread_pool&) = delete;
+
+            unsigned size() const { return n_threads; }
+
+            // call task(i) for every thread index i in [0, size()), the calling
+            // thread takes i = 0. No allocation, the task is passed by reference.
+            // If tasks throw, the first exception caught is rethrown here once
+            // every thread is done
+            template <typename Task>
+            void run(Task& task) {
+                if (n_threads == 1) { task(0u); return; }
+
+                context  = &task;
+                function = [](void* ctx, unsigned i) { (*static_cast<Task*>(ctx))(i); };
+                error    = nullptr;
+                pending.store(n_threads - 1, std::memory_order_relaxed);
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    generation.fetch_add(1, std::memory_order_release);
+                }
+                cv.notify_all();
+
+                // the workers still use the task, wait for them anyway
+                std::exception_ptr own;
+                try { task(0u); }
+                catch (...) { own = std::current_exception(); }
+
+                for (unsigned spins = 0; pending.load(std::memory_order_acquire) != 0; ++spins) {
+                    if (spins < 256) cpu_relax();
+                    else std::this_thread::yield();
+                }
+                if (own) std::rethrow_exception(own);
+                if (error) std::rethrow_exception(error);
+            }
+
+            private:
+
+            void work(unsigned i) {
+                // not loaded here, the first task may already be out
+                unsigned seen = 0;
+                while (true) {
+                    for (unsigned spins = 0; generation.load(std::memory_order_acquire) == seen; ++spins) {
+                        if (spins < 256) cpu_relax();
+                        else if (spins < 512) std::this_thread::yield();
+                        else {
+                            std::unique_lock<std::mutex> lock(mtx);
+                            cv.wait(lock, [&]() {
+                                return generation.load(std::memory_order_acquire) != seen;
+                            });
+                        }
+                    }
+                    seen = generation.load(std::memory_order_acquire);
+                    if (stop) return;
+
+                    try { function(context, i); }
+                    catch (...) {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        if (!error) error = std::current_exception();
+                    }
+                    pending.fetch_sub(1, std::memory_order_acq_rel);
+                }
+            }
+
+            unsigned n_threads;
+            std::vector<std::thread> workers;
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::atomic<unsigned> generation;
+            std::atomic<unsigned> pending;
+            bool stop;
+            void* context = nullptr;
+            void (*function)(void*, unsigned) = nullptr;
+            // first exception thrown by a worker in the current run
+            std::exception_ptr error;
+        };
+    }
+}
+
+#endif
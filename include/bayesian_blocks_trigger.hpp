@@ -0,0 +1,298 @@
+// Copyright (c) 2019 Luigi Pertoldi
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "bayesian_blocks.hpp"
+
+#ifndef _BAYESIAN_BLOCKS_TRIGGER_HH
+#define _BAYESIAN_BLOCKS_TRIGGER_HH
+
+namespace BayesianBlocks {
+
+    namespace bb {
+
+        // change point emitted by a Trigger
+        struct change_point {
+            double time;       // edge between the two blocks
+            double rate;       // event rate of the block that ends here
+            double latency;    // stream time from the change point to its emission
+            bool   confirmed;  // no later event can move it
+        };
+    }
+
+    // Bayesian blocks as a trigger on a stream of time-ordered events
+    // (Scargle et al. 2012, sec. 3.6), with memory and cost per event bounded
+    // by the window size.
+    //
+    // The pruned recursion runs over the events since the last cut. Every
+    // future partition ends with a block that starts at one of the alive
+    // candidates, so once the optimal partitions up to all of them share a
+    // change point, it is final: it is emitted as confirmed, and the events
+    // before it are dropped. Up to that point the change points are the ones of
+    // blocks() on the whole stream, with the prior calibrated on n_calib
+    // values (see Engine).
+    //
+    // A change point of the current partition that is max_latency older than
+    // the last event is emitted anyway, unconfirmed, and the stream is cut
+    // there. Change points only enter the partition once enough events after
+    // them are seen: max_latency bounds the time they are held back from then
+    // on. The stream is also cut in the middle of the window when it holds
+    // more than window distinct values. Later change points are then the
+    // ones of the data after the cut, whose steps are done again: O(window)
+    // times the alive candidates, at most once every window/2 values for the
+    // window cuts
+    class Trigger {
+
+        public:
+
+        Trigger(const double p, std::size_t n_calib, std::size_t window,
+                double max_latency = std::numeric_limits<double>::infinity(),
+                const bb::options& opts = bb::options());
+
+        // event at time t with weight w, t must not be smaller than the previous one
+        void push(double t, double w = 1);
+        // events in [first, last), in time order
+        template <typename It>
+        void push(It first, It last) { for (; first != last; ++first) this->push(*first); }
+
+        // end of the stream: the remaining change points of the partition of
+        // the window are emitted, as confirmed, and the trigger starts over
+        void flush();
+
+        // next emitted change point, in time order, if any
+        bool poll(bb::change_point& cp);
+        std::size_t pending() const { return queue.size(); }
+
+        // distinct values in the window
+        std::size_t size() const { return N; }
+        double ncp_prior() const { return ncp; }
+
+        private:
+
+        // emit the change points up to c and make c the first cell. With
+        // on_chain, c is one of them, otherwise those of the current partition
+        // before c are emitted
+        void cut(std::size_t c, bool confirmed, bool on_chain);
+        // emit change point n and the ones before it, oldest first
+        void emit(std::size_t n, bool confirmed);
+        // the change point shared by all future partitions, 0 if none
+        std::size_t common();
+
+        bb::options opts;
+        double ncp;
+        std::size_t window;
+        double max_latency;
+        detail::solver<double> dp;
+        bb::array cumw;
+        bb::array edges;
+        std::size_t N = 0;
+        double t_last = 0;
+        std::size_t n_alive = 0;
+        std::deque<bb::change_point> queue;
+        std::vector<std::size_t> heap, chain;
+    };
+}
+
+namespace BayesianBlocks {
+
+    namespace detail {
+
+        // the trigger always prunes, which is what makes change points final
+        inline bb::options trigger_options(bb::options opts) {
+            opts.pruned    = true;
+            opts.max_block = 0;
+            opts.grid      = 0;
+            opts.segments  = 0;
+            opts.observer  = nullptr;
+            opts.report    = nullptr;
+            opts.cache     = nullptr;
+            return opts;
+        }
+    }
+
+#ifdef BAYESIAN_BLOCKS_DEFINITIONS
+    BAYESIAN_BLOCKS_INLINE Trigger::Trigger(const double p, std::size_t n_calib, std::size_t window,
+                                            double max_latency, const bb::options& opts) :
+        opts(detail::trigger_options(opts)),
+        ncp(detail::ncp_prior(p, n_calib)),
+        window(window),
+        max_latency(max_latency),
+        dp(this->opts, ncp) {
+
+        if (n_calib == 0) {
+            throw std::invalid_argument("ERROR: the prior must be calibrated on at least one value");
+        }
+        if (window < 4) {
+            throw std::invalid_argument("ERROR: the trigger window must hold at least 4 values");
+        }
+        if (!(max_latency > 0)) {
+            throw std::invalid_argument("ERROR: the maximum latency must be positive");
+        }
+        cumw.reserve(window + 2);
+        edges.reserve(window + 2);
+    }
+
+    BAYESIAN_BLOCKS_INLINE void Trigger::push(double t, double w) {
+
+        if (!(w > 0) or !std::isfinite(w)) {
+            throw std::domain_error("ERROR: invalid weight found in input");
+        }
+        if (!std::isfinite(t) or (N > 0 and t < t_last)) {
+            throw std::invalid_argument("ERROR: events must be finite and in time order");
+        }
+
+        // same time as the previous event: its step is not done yet
+        if (N > 0 and t == t_last) {
+            cumw[N] += w;
+            return;
+        }
+
+        if (N == 0) {
+            cumw.assign(1, 0.);
+            edges.assign(1, t);
+        }
+        else edges[N] = (t_last + t)/2.;
+        edges.push_back(t);
+        cumw.push_back(cumw[N] + w);
+        t_last = t;
+        ++N;
+
+        // all steps but the last one, as in Engine
+        dp.advance(cumw.data(), edges.data(), N-1);
+
+        // the common change point can only move forward when candidates are
+        // dropped, otherwise the alive ones just grew by the last step
+        bool dropped = dp.alive().size() != n_alive + 1;
+        if (dropped) {
+            const auto c = this->common();
+            if (c > 0) this->cut(c, true, true);
+        }
+
+        // the latest change point of the current partition past the latency
+        if (N > 1 and std::isfinite(max_latency)) {
+            const auto deadline = t - max_latency;
+            auto c = dp.last[N-2];
+            while (c > 0 and edges[c] > deadline) c = dp.last[c-1];
+            if (c > 0) {
+                this->cut(c, false, true);
+                dropped = true;
+            }
+        }
+        if (N > window) {
+            this->cut(N - window/2, false, false);
+            dropped = true;
+        }
+        // forced cuts drop the candidates before them
+        if (dropped) {
+            const auto c = this->common();
+            if (c > 0) this->cut(c, true, true);
+        }
+
+        n_alive = dp.alive().size();
+    }
+
+    BAYESIAN_BLOCKS_INLINE std::size_t Trigger::common() {
+        // walk back the partitions ending at every candidate, latest first,
+        // until they meet. Candidate r starts the last block, the one before
+        // starts at last[r-1]; N-1 is the candidate of the pending step
+        heap.assign(dp.alive().begin(), dp.alive().end());
+        heap.push_back(N-1);
+        std::make_heap(heap.begin(), heap.end());
+        while (true) {
+            std::pop_heap(heap.begin(), heap.end());
+            const auto m = heap.back();
+            heap.pop_back();
+            while (!heap.empty() and heap.front() == m) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
+            if (heap.empty() or m == 0) return m;
+            heap.push_back(dp.last[m-1]);
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    BAYESIAN_BLOCKS_INLINE void Trigger::cut(std::size_t c, bool confirmed, bool on_chain) {
+
+        auto n = c;
+        if (!on_chain) {
+            n = dp.last[N-2];
+            while (n > c) n = dp.last[n-1];
+        }
+        this->emit(n, confirmed);
+
+        // c becomes the first cell, the recursion goes on from there
+        const auto W_c = cumw[c];
+        cumw.erase(cumw.begin(), cumw.begin() + c);
+        for (auto& v : cumw) v -= W_c;
+        edges.erase(edges.begin(), edges.begin() + c);
+        N -= c;
+        // a confirmed change point is on every partition that is still to
+        // come, nothing changes but the offsets. Otherwise the steps since c
+        // were taken with blocks that start before it: they are done again
+        if (confirmed) dp.rebase(c, W_c);
+        else {
+            dp.reset(opts, ncp);
+            dp.advance(cumw.data(), edges.data(), N-1);
+        }
+    }
+
+    BAYESIAN_BLOCKS_INLINE void Trigger::emit(std::size_t n, bool confirmed) {
+        chain.clear();
+        for (; n > 0; n = dp.last[n-1]) chain.push_back(n);
+
+        std::size_t prev = 0;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            bb::change_point cp;
+            cp.time      = edges[*it];
+            cp.rate      = (cumw[*it] - cumw[prev]) / (edges[*it] - edges[prev]);
+            cp.latency   = t_last - cp.time;
+            cp.confirmed = confirmed;
+            queue.push_back(cp);
+            prev = *it;
+        }
+    }
+
+    BAYESIAN_BLOCKS_INLINE void Trigger::flush() {
+        if (N > 1) {
+            // the step of the last value is final now
+            dp.advance(cumw.data(), edges.data(), N);
+            this->emit(dp.last[N-1], true);
+        }
+        dp.reset(opts, ncp);
+        N = 0;
+        n_alive = 0;
+    }
+
+    BAYESIAN_BLOCKS_INLINE bool Trigger::poll(bb::change_point& cp) {
+        if (queue.empty()) return false;
+        cp = queue.front();
+        queue.pop_front();
+        return true;
+    }
+#endif
+}
+
+#endif
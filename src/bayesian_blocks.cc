@@ -0,0 +1,21 @@
+// Compiled part of libbayesianblocks: the non-template functions of the
+// headers and the float and double instances of the engine, see
+// bayesian_blocks_config.hpp. Programs built with -DBAYESIAN_BLOCKS_COMPILED_LIB
+// link against it instead of compiling the engine in each translation unit
+
+#define BAYESIAN_BLOCKS_SOURCE
+
+#include "../include/bayesian_blocks.hpp"
+#include "../include/bayesian_blocks_engine.hpp"
+#include "../include/bayesian_blocks_trigger.hpp"
+#include "../include/bayesian_blocks_io.hpp"
+#include "../include/bayesian_blocks_ooc.hpp"
+#include "../include/bayesian_blocks_bootstrap.hpp"
+
+namespace BayesianBlocks {
+    BAYESIAN_BLOCKS_INSTANTIATE(, float)
+    BAYESIAN_BLOCKS_INSTANTIATE(, double)
+    BAYESIAN_BLOCKS_INSTANTIATE_MEASUREMENTS()
+    BAYESIAN_BLOCKS_INSTANTIATE_BOOTSTRAP(, float)
+    BAYESIAN_BLOCKS_INSTANTIATE_BOOTSTRAP(, double)
+}
@@ -0,0 +1,7 @@
+// Compiled part of libbayesianblocks_root: the ROOT interface, on top of
+// libbayesianblocks
+
+#define BAYESIAN_BLOCKS_COMPILED_LIB
+#define BAYESIAN_BLOCKS_ROOT_SOURCE
+
+#include "../include/bayesian_blocks_root.hpp"
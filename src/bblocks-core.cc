@@ -0,0 +1,184 @@
+#include <getopt.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+
+#include "../include/bayesian_blocks.hpp"
+#include "../include/bayesian_blocks_io.hpp"
+
+// Bayesian blocks of unbinned events in raw float64 or text files, with no
+// dependency on ROOT. One line per file (and per p0), tab separated: the
+// file name, p0 and the change points
+
+namespace {
+
+    bool verbose = false;
+
+    // raw little-endian float64, by extension unless --raw is given
+    bool is_raw(const std::string& filename) {
+        for (std::string ext : { ".bin", ".raw", ".f64" }) {
+            if (filename.size() > ext.size() and
+                filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0) return true;
+        }
+        return false;
+    }
+
+    void print(std::FILE* out, const std::string& filename, double p0, const std::vector<double>& edges) {
+        std::fprintf(out, "%s\t%.17g\t", filename.c_str(), p0);
+        for (std::size_t i = 0; i < edges.size(); ++i) {
+            std::fprintf(out, i == 0 ? "%.17g" : " %.17g", edges[i]);
+        }
+        std::fprintf(out, "\n");
+    }
+}
+
+int main(int argc, char** argv) {
+
+    std::string progname(argv[0]);
+
+    auto usage = [&]() {
+        std::cerr << "USAGE: " << progname << " [-v|--verbose] [-h|--help] [--p0 <val> (default 0.01)] [--p0-scan <val1,val2,...>] [-c|--column <n> (default 0)] [-w|--weights <n>] [--raw] [--pruned] [-j|--jobs <n> (default 1)] [-o|--output <file>] file [file2...]\n";
+    };
+
+    const char* const short_opts = "c:w:j:o:vh";
+    const option long_opts[] = {
+        { "p0",         required_argument, nullptr, 1   },
+        { "p0-scan",    required_argument, nullptr, 2   },
+        { "raw",        no_argument,       nullptr, 3   },
+        { "pruned",     no_argument,       nullptr, 4   },
+        { "column",     required_argument, nullptr, 'c' },
+        { "weights",    required_argument, nullptr, 'w' },
+        { "jobs",       required_argument, nullptr, 'j' },
+        { "output",     required_argument, nullptr, 'o' },
+        { "verbose",    no_argument,       nullptr, 'v' },
+        { "help",       no_argument,       nullptr, 'h' },
+        { nullptr,      no_argument,       nullptr, 0   }
+    };
+
+    // defaults
+    double p0 = 0.01;
+    std::vector<double> p0_scan;
+    std::size_t column = 0;
+    long weight_column = -1;
+    bool raw = false;
+    std::string outfile = "";
+    BayesianBlocks::bb::options opts;
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1) {
+        switch (opt) {
+            case 1:
+                p0 = std::stod(optarg);
+                break;
+            case 2:
+                // comma separated list of values
+                try {
+                    p0_scan = BayesianBlocks::parse_list(optarg);
+                }
+                catch (const std::invalid_argument& e) {
+                    std::cerr << e.what() << std::endl;
+                    usage();
+                    return 1;
+                }
+                break;
+            case 3:
+                raw = true;
+                break;
+            case 4:
+                opts.pruned = true;
+                break;
+            case 'c':
+                column = std::stoul(optarg);
+                break;
+            case 'w':
+                weight_column = std::stol(optarg);
+                break;
+            case 'j':
+                opts.threads = std::stoul(optarg);
+                // 0 means all available cores
+                if (opts.threads == 0) opts.threads = std::max(std::thread::hardware_concurrency(), 1u);
+                break;
+            case 'o':
+                outfile = std::string(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            case '?': // Unrecognized option
+                std::cerr << "ERROR: unrecognized option!" << std::endl;
+                return 1;
+            case 'h': // -h or --help
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // extra arguments
+    std::vector<std::string> args;
+    for(; optind < argc; optind++){
+        args.emplace_back(argv[optind]);
+    }
+    if (args.empty()) {usage(); return 1;}
+
+    std::FILE* out = stdout;
+    if (!outfile.empty()) {
+        out = std::fopen(outfile.c_str(), "w");
+        if (!out) {
+            std::cerr << "ERROR: could not open " << outfile << " for writing" << std::endl;
+            return 1;
+        }
+    }
+
+    int status = 0;
+    BayesianBlocks::bb::workspace<double> ws;
+    for (const auto& filename : args) {
+        try {
+            if (raw or is_raw(filename)) {
+                if (weight_column >= 0) {
+                    throw std::invalid_argument("ERROR: raw files hold no weights");
+                }
+                // values are read in place from the mapping
+                BayesianBlocks::bb::raw_input input(filename);
+                if (verbose) std::cerr << filename << ": " << input.size() << " raw values" << std::endl;
+                if (p0_scan.empty()) {
+                    print(out, filename, p0, BayesianBlocks::blocks(input.begin(), input.end(), p0, ws, opts));
+                }
+                else {
+                    auto scan = BayesianBlocks::blocks_scan(std::vector<double>(input.begin(), input.end()),
+                                                            p0_scan, opts);
+                    for (std::size_t j = 0; j < p0_scan.size(); ++j) print(out, filename, p0_scan[j], scan[j]);
+                }
+            }
+            else {
+                BayesianBlocks::bb::array values, weights;
+                if (weight_column >= 0) values = BayesianBlocks::read_text(filename, column, weight_column, weights);
+                else values = BayesianBlocks::read_text(filename, column);
+                if (verbose) std::cerr << filename << ": " << values.size() << " values" << std::endl;
+                if (p0_scan.empty()) {
+                    print(out, filename, p0, weight_column >= 0
+                          ? BayesianBlocks::blocks(values.begin(), values.end(), weights.begin(), p0, ws, opts)
+                          : BayesianBlocks::blocks(values.begin(), values.end(), p0, ws, opts));
+                }
+                else {
+                    auto scan = weight_column >= 0
+                        ? BayesianBlocks::blocks_scan(std::move(values), std::move(weights), p0_scan, opts)
+                        : BayesianBlocks::blocks_scan(std::move(values), p0_scan, opts);
+                    for (std::size_t j = 0; j < p0_scan.size(); ++j) print(out, filename, p0_scan[j], scan[j]);
+                }
+            }
+        }
+        catch (const std::exception& e) {
+            std::cerr << filename << ": " << e.what() << std::endl;
+            status = 1;
+        }
+    }
+
+    if (out != stdout) std::fclose(out);
+    return status;
+}
@@ -3,8 +3,17 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 
 #include "../include/bayesian_blocks_root.hpp"
+#include "../include/bayesian_blocks_io.hpp"
 
 // ROOT
 #include "TObject.h"
@@ -13,6 +22,8 @@
 #include "TIterator.h"
 #include "TKey.h"
 #include "TClass.h"
+#include "TROOT.h"
+#include "TTree.h"
 
 enum log_level {debug, info, warning, error};
 
@@ -67,30 +78,54 @@ std::pair<std::string, std::string> split_dir_file(std::string expr) {
     return std::pair<std::string, std::string>(directory, file);
 }
 
+// a unit of work of the pipeline. Input files are delimited by begin/end
+// markers so that the writer can log and open the output files in order
+struct job {
+    enum kind_t {file_begin, hist, file_end} kind;
+    std::size_t seq = 0;
+    std::string label;               // input file name or histogram name
+    std::string outname;             // output file of the input file
+    TH1* in  = nullptr;              // owned
+    TH1* out = nullptr;              // owned
+    std::vector<TH1*> outs;          // owned, one per prior (--p0-scan)
+    const TArrayD* edges = nullptr;  // if set, reuse these edges (--uniform)
+    std::string error;
+};
+
 int main(int argc, char** argv) {
 
     std::string progname(argv[0]);
 
     auto usage = [&]() {
-        std::cerr << "USAGE: " << progname << " [-v|--verbose] [-h|--help] [--p0 <val> (default 0.01)] file|file:obj [file2...]\n";
+        std::cerr << "USAGE: " << progname << " [-v|--verbose] [-h|--help] [--p0 <val> (default 0.01)] [--p0-scan <val1,val2,...>] [-b|--binned] [-j|--jobs <n> (default 1)] [--cache-dir <dir>] [--cache-size <MiB> (default unlimited)] file|file:obj|file:tree/column [file2...]\n";
     };
 
-    const char* const short_opts = "o:usvh";
+    const char* const short_opts = "o:usbj:vh";
     const option long_opts[] = {
-        { "p0",      required_argument, nullptr, 1   },
-        { "output",  required_argument, nullptr, 'o' },
-        { "uniform", no_argument,       nullptr, 'u' },
-        { "samedir", no_argument,       nullptr, 's' },
-        { "verbose", no_argument,       nullptr, 'v' },
-        { "help",    no_argument,       nullptr, 'h' },
-        { nullptr,   no_argument,       nullptr, 0   }
+        { "p0",         required_argument, nullptr, 1   },
+        { "cache-dir",  required_argument, nullptr, 2   },
+        { "cache-size", required_argument, nullptr, 3   },
+        { "p0-scan",    required_argument, nullptr, 4   },
+        { "output",     required_argument, nullptr, 'o' },
+        { "uniform",    no_argument,       nullptr, 'u' },
+        { "samedir",    no_argument,       nullptr, 's' },
+        { "binned",     no_argument,       nullptr, 'b' },
+        { "jobs",       required_argument, nullptr, 'j' },
+        { "verbose",    no_argument,       nullptr, 'v' },
+        { "help",       no_argument,       nullptr, 'h' },
+        { nullptr,      no_argument,       nullptr, 0   }
     };
 
     // defaults
     double p0 = 0.01;
+    std::vector<double> p0_scan;
     std::string outfile = "";
     bool uniform = false;
     bool samedir = false;
+    bool binned = false;
+    unsigned jobs = 1;
+    std::string cache_dir = "";
+    std::uint64_t cache_size = 0;
 
     int opt = 0;
     while ((opt = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1) {
@@ -98,6 +133,23 @@ int main(int argc, char** argv) {
             case 1:
                 p0 = std::stod(optarg);
                 break;
+            case 2:
+                cache_dir = std::string(optarg);
+                break;
+            case 3:
+                cache_size = std::stoull(optarg) << 20;
+                break;
+            case 4:
+                // comma separated list of values
+                try {
+                    p0_scan = BayesianBlocks::parse_list(optarg);
+                }
+                catch (const std::invalid_argument& e) {
+                    std::cerr << e.what() << std::endl;
+                    usage();
+                    return 1;
+                }
+                break;
             case 'o':
                 outfile = std::string(optarg);
                 break;
@@ -107,6 +159,14 @@ int main(int argc, char** argv) {
             case 's':
                 samedir = true;
                 break;
+            case 'b':
+                binned = true;
+                break;
+            case 'j':
+                jobs = std::stoul(optarg);
+                // 0 means all available cores
+                if (jobs == 0) jobs = std::max(std::thread::hardware_concurrency(), 1u);
+                break;
             case 'v':
                 level = debug;
                 break;
@@ -120,8 +180,32 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (!p0_scan.empty() and uniform) {
+        glog(error) << "ERROR: --p0-scan and --uniform cannot be used together" << std::endl;
+        return 1;
+    }
+
     if (p0 != 0.01) glog(debug) << "p0 set to " << p0 << std::endl;
+    if (!p0_scan.empty()) glog(debug) << "scanning " << p0_scan.size() << " p0 values" << std::endl;
     if (!outfile.empty()) glog(debug) << "custom output file set to " << outfile << std::endl;
+    if (binned) glog(debug) << "treating histograms as binned data" << std::endl;
+    if (jobs > 1) glog(debug) << "running with " << jobs << " worker threads" << std::endl;
+
+    // results of previous runs
+    std::unique_ptr<BayesianBlocks::edge_cache> cache;
+    BayesianBlocks::bb::options opts;
+    if (!cache_dir.empty()) {
+        cache.reset(new BayesianBlocks::edge_cache(cache_dir, cache_size));
+        opts.cache = cache.get();
+        glog(debug) << "using edge cache in " << cache_dir << " (" << cache->entries()
+                    << " entries, " << cache->bytes() << " bytes)" << std::endl;
+    }
+
+    // unbinned (bin centers as events) or binned rebinning
+    auto rebin = [&](TH1* h) {
+        return binned ? BayesianBlocks::rebin_binned(h, p0, opts, false, false)
+                      : BayesianBlocks::rebin(h, p0, opts, false, false);
+    };
 
     // extra arguments
     std::vector<std::string> args;
@@ -130,16 +214,164 @@ int main(int argc, char** argv) {
     }
     if (args.empty()) {usage(); return 1;}
 
+    // histograms are owned by the pipeline, not by the files they come from,
+    // so that input files can be closed while their histograms are processed
+    TH1::AddDirectory(kFALSE);
+    if (jobs > 1) ROOT::EnableThreadSafety();
+
+    // compute stage
+    auto process = [&](job& j) {
+        if (j.kind != job::hist) return;
+        try {
+            // use edges from first histogram
+            if (j.edges) {
+                j.out = j.in->Rebin(j.edges->GetSize()-1, j.in->GetName(), j.edges->GetArray());
+                j.out->Scale(1, "width");
+            }
+            // one histogram per prior, sharing the preparation of the data
+            else if (!p0_scan.empty()) {
+                j.outs = binned ? BayesianBlocks::rebin_binned_scan(j.in, p0_scan, opts)
+                                : BayesianBlocks::rebin_scan(j.in, p0_scan, opts);
+            }
+            // compute edges
+            else j.out = dynamic_cast<TH1D*>(rebin(j.in));
+        }
+        catch(const std::exception& e) {
+            j.error = e.what();
+        }
+    };
+
+    // write stage, must see the jobs in order
+    std::unique_ptr<TFile> fout;
+    auto write = [&](job& j) {
+        switch (j.kind) {
+            case job::file_begin:
+                glog(debug) << j.label << std::endl;
+                break;
+            case job::hist:
+                glog(debug) << " ├─ " << j.label;
+                if (j.edges) std::cout << " (using cached bin edges)";
+                if (!j.error.empty()) {
+                    if (level <= debug) std::cerr << " \033[91m✘\033[0m " << j.error << ". Skipping.\n";
+                }
+                else {
+                    if (!fout) fout.reset(new TFile(j.outname.c_str(), "update"));
+                    fout->cd();
+                    if (j.out) {
+                        auto name = std::string(j.out->GetName());
+                        if (*(name.end()-1) == 'b' and *(name.end()-2) == '_') {
+                            name.erase(name.end()-2, name.end());
+                        }
+                        j.out->Write(name.c_str());
+                    }
+                    // <name>_b_p<value> is written as <name>_p<value>
+                    for (auto h : j.outs) {
+                        auto name = std::string(h->GetName());
+                        name.erase(std::string(j.in->GetName()).size(), 2);
+                        h->Write(name.c_str());
+                    }
+                    if (level <= debug) std::cout << " \033[92m✔\033[0m\n";
+                }
+                delete j.in;
+                delete j.out;
+                for (auto h : j.outs) delete h;
+                break;
+            case job::file_end:
+                glog(debug) << " └─ done\n";
+                if (fout) {
+                    fout.reset();
+                    glog(info) << j.outname << " written\n";
+                }
+                break;
+        }
+    };
+
+    // pipeline state, unused in serial mode
+    std::mutex mtx;
+    std::condition_variable cv_work, cv_done, cv_room;
+    std::deque<job> todo;
+    std::map<std::size_t, job> done;
+    std::size_t n_submitted = 0, n_written = 0;
+    bool reading = true;
+    const std::size_t max_in_flight = 4*jobs;
+
+    // hand a job over to the workers (or to the writer if already processed)
+    auto submit = [&](job j, bool processed) {
+        if (jobs == 1) {
+            if (!processed) process(j);
+            write(j);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        // bound the number of histograms in memory
+        cv_room.wait(lock, [&] { return n_submitted - n_written < max_in_flight; });
+        j.seq = n_submitted++;
+        if (processed) {
+            done.emplace(j.seq, std::move(j));
+            cv_done.notify_one();
+        }
+        else {
+            todo.push_back(std::move(j));
+            cv_work.notify_one();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    std::thread writer;
+    if (jobs > 1) {
+        for (unsigned t = 0; t < jobs; ++t) workers.emplace_back([&] {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true) {
+                cv_work.wait(lock, [&] { return !todo.empty() or !reading; });
+                if (todo.empty()) return;
+                auto j = std::move(todo.front());
+                todo.pop_front();
+                lock.unlock();
+                process(j);
+                lock.lock();
+                done.emplace(j.seq, std::move(j));
+                cv_done.notify_one();
+            }
+        });
+        // reorder the results, so that they are written in the serial order
+        writer = std::thread([&] {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true) {
+                cv_done.wait(lock, [&] { return done.count(n_written) or (!reading and n_written == n_submitted); });
+                auto it = done.find(n_written);
+                if (it == done.end()) return;
+                auto j = std::move(it->second);
+                done.erase(it);
+                lock.unlock();
+                write(j);
+                lock.lock();
+                ++n_written;
+                cv_room.notify_one();
+            }
+        });
+    }
+
     TArrayD saved_edges;
 
     // iterate over files
     // if no output filename is specified make an output file for each file
     for (auto& f : args) {
-        glog(debug) << f << std::endl;
 
-        std::vector<TObject*> hists;
         auto file_obj = get_file_obj(f);
 
+        std::string outname;
+        if (!outfile.empty())
+            outname = outfile;
+        else {
+            outname = "bb-" + (split_dir_file(file_obj.first)).second;
+            if (samedir) outname = (split_dir_file(file_obj.first)).first + "/" + outname;
+        }
+
+        job begin;
+        begin.kind = job::file_begin;
+        begin.label = f;
+        submit(std::move(begin), true);
+
         // open file
         TFile _tmp(file_obj.first.c_str(), "read");
 
@@ -153,33 +385,37 @@ int main(int argc, char** argv) {
                 if (cl->InheritsFrom("TH1")) {
                     auto h = dynamic_cast<TH1*>(key->ReadObj());
                     if (h->GetDimension() == 1) {
-                        glog(debug) << " ├─ " << h->GetName();
-
-                        bool found = false;
-                        for (int b = 1; b < h->GetNbinsX(); ++b) {
-                            auto c = h->GetBinContent(b);
-                            if (floor(c) != ceil(c)) {
-                                if (!found) std::cerr << " \033[93m✘\033[0m non-integer bin contents detected, they will be rounded.";
-                                h->SetBinContent(b, std::round(c));
-                                found = true;
-                            }
-                        }
-
-
-                        TH1* hr;
-                        try {
-                            hr = dynamic_cast<TH1D*>(BayesianBlocks::rebin(h, p0, false, false));
-                        }
-                        catch(const std::exception& e) {
-                            if (level <= debug) std::cerr << " \033[91m✘\033[0m " << e.what() << ". Skipping.\n";
-                            continue;
-                        }
-                        hists.push_back(hr);
-                        if (level <= debug) std::cout << " \033[92m✔\033[0m\n";
+                        job j;
+                        j.kind = job::hist;
+                        j.label = h->GetName();
+                        j.outname = outname;
+                        j.in = h;
+                        submit(std::move(j), false);
                     }
+                    else delete h;
                 }
             }
         }
+        // a column of a tree (trees are owned by their file), as unbinned
+        // events read by -j threads
+        else if (!split_dir_file(file_obj.second).first.empty() and
+                 dynamic_cast<TTree*>(_tmp.Get(split_dir_file(file_obj.second).first.c_str()))) {
+            auto tree_column = split_dir_file(file_obj.second);
+            job j;
+            j.kind = job::hist;
+            j.label = file_obj.second;
+            j.outname = outname;
+            try {
+                if (!p0_scan.empty()) throw std::runtime_error("--p0-scan is not supported for trees");
+                auto o = opts;
+                o.threads = jobs;
+                j.out = BayesianBlocks::blocks_tree(file_obj.first, tree_column.first, tree_column.second, p0, o);
+            }
+            catch(const std::exception& e) {
+                j.error = e.what();
+            }
+            submit(std::move(j), true);
+        }
         // otherwise, process that object only
         else {
             auto h = dynamic_cast<TH1*>(_tmp.Get(file_obj.second.c_str()));
@@ -189,59 +425,47 @@ int main(int argc, char** argv) {
             tmp_file_obj.ReplaceAll('/', '_');
             h->SetName(tmp_file_obj);
 
-            glog(debug) << " ├─ " << h->GetName();
-
-            TH1* hr;
-            // use edges from first histogram
-            if (saved_edges.GetSize() > 0 and uniform == true) {
-                hr = h->Rebin(saved_edges.GetSize()-1, tmp_file_obj, saved_edges.GetArray());
-                hr->Scale(1, "width");
-                std::cout << " (using cached bin edges)";
+            job j;
+            j.kind = job::hist;
+            j.label = h->GetName();
+            j.outname = outname;
+            j.in = h;
+            if (uniform == true and saved_edges.GetSize() > 0) {
+                j.edges = &saved_edges;
+                submit(std::move(j), false);
             }
-            // compute edges
-            else {
-                bool found = false;
-                for (int b = 1; b < h->GetNbinsX(); ++b) {
-                    auto c = h->GetBinContent(b);
-                    if (floor(c) != ceil(c)) {
-                        if (!found) std::cerr << " \033[93m✘\033[0m non-integer bin contents detected, they will be rounded.";
-                        h->SetBinContent(b, std::round(c));
-                        found = true;
-                    }
-                }
-
-                try {
-                    hr = dynamic_cast<TH1D*>(BayesianBlocks::rebin(h, p0, false, false));
-                    saved_edges = *hr->GetXaxis()->GetXbins();
-                }
-                catch(const std::exception& e) {
-                    if (level <= debug) std::cerr << " \033[91m✘\033[0m " << e.what() << ". Skipping.\n";
-                    continue;
-                }
+            // the edges of the first histogram are needed by the following
+            // ones, compute them right away
+            else if (uniform == true) {
+                process(j);
+                if (j.error.empty()) saved_edges = *j.out->GetXaxis()->GetXbins();
+                submit(std::move(j), true);
             }
-            hists.push_back(hr);
-            if (level <= debug) std::cout << " \033[92m✔\033[0m\n";
+            else submit(std::move(j), false);
         }
-        glog(debug) << " └─ done\n";
-
-        if (!hists.empty()) {
-            std::string outname;
-            if (!outfile.empty())
-                outname = outfile;
-            else {
-                outname = "bb-" + (split_dir_file(file_obj.first)).second;
-                if (samedir) outname = (split_dir_file(file_obj.first)).first + "/" + outname;
-            }
-            TFile fout(outname.c_str(), "update");
-            for (auto& i : hists) {
-                auto name = std::string(i->GetName());
-                if (*(name.end()-1) == 'b' and *(name.end()-2) == '_') {
-                    name.erase(name.end()-2, name.end());
-                }
-                i->Write(name.c_str());
-            }
-            glog(info) << outname << " written\n";
+
+        job end;
+        end.kind = job::file_end;
+        end.outname = outname;
+        submit(std::move(end), true);
+    }
+
+    if (jobs > 1) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            reading = false;
         }
+        cv_work.notify_all();
+        cv_done.notify_all();
+        for (auto& t : workers) t.join();
+        writer.join();
+    }
+
+    if (cache) {
+        cache->flush();
+        glog(debug) << "edge cache: " << cache->hits() << " hits, " << cache->misses()
+                    << " misses, " << cache->evictions() << " evictions" << std::endl;
     }
+
     return 0;
 }
@@ -0,0 +1,305 @@
+#include <getopt.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#include "../include/bayesian_blocks_root.hpp"
+#include "TH1D.h"
+
+namespace bb = BayesianBlocks::bb;
+
+// synthetic event sets
+std::vector<double> generate(const std::string& dataset, std::size_t N, std::mt19937& gen) {
+    std::vector<double> events;
+    events.reserve(N);
+    // constant rate
+    if (dataset == "uniform") {
+        std::uniform_real_distribution<double> u(0, N);
+        for (std::size_t i = 0; i < N; ++i) events.push_back(u(gen));
+    }
+    // rate switching between 1 and 5 every 1000 events
+    else if (dataset == "piecewise") {
+        std::exponential_distribution<double> slow(1.), fast(5.);
+        double t = 0;
+        for (std::size_t i = 0; i < N; ++i) {
+            t += (i/1000)%2 ? slow(gen) : fast(gen);
+            events.push_back(t);
+        }
+    }
+    // about 50 events per distinct value
+    else if (dataset == "duplicates") {
+        std::normal_distribution<double> n(0, 1);
+        const double step = 8./std::max<std::size_t>(N/50, 1);
+        for (std::size_t i = 0; i < N; ++i) events.push_back(std::round(n(gen)/step)*step);
+    }
+    return events;
+}
+
+// blocks_binned() on a histogram of about 10 events per bin, edges stored as T
+template <typename T>
+void binned(const std::vector<double>& events) {
+    const auto range = std::minmax_element(events.begin(), events.end());
+    const std::size_t n_bins = std::max<std::size_t>(events.size()/10, 1);
+    const double width = (*range.second - *range.first)/n_bins;
+    std::vector<T> edges(n_bins+1);
+    std::vector<double> counts(n_bins, 0.);
+    for (std::size_t i = 0; i <= n_bins; ++i) edges[i] = *range.first + i*width;
+    for (auto& v : events) ++counts[std::min<std::size_t>((v - *range.first)/width, n_bins-1)];
+    BayesianBlocks::blocks_binned(edges, counts, 0.01);
+}
+
+// pruning drops next to no candidate on flat data, the pruned engines stay
+// quadratic there: reported as such instead of as a plain budget skip
+bool worst_case(const std::string& dataset, const std::string& engine) {
+    return dataset == "uniform" and (engine == "blocks/pruned" or engine == "blocks/segments");
+}
+
+// the exhaustive recursion with the Cash fitness written out in a scalar
+// loop, as before the fitness policies: the baseline of blocks/scalar, which
+// runs the same recursion through fitness::events
+std::size_t hardcoded(std::vector<double> x) {
+    std::sort(x.begin(), x.end());
+    std::vector<double> values, cumw(1, 0.);
+    for (auto v : x) {
+        if (values.empty() or v != values.back()) {
+            values.push_back(v);
+            cumw.push_back(cumw.back());
+        }
+        cumw.back() += 1;
+    }
+    const auto N = values.size();
+    std::vector<double> edges(N+1);
+    edges[0] = values[0];
+    for (std::size_t i = 1; i < N; ++i) edges[i] = (values[i-1] + values[i])/2.;
+    edges[N] = values[N-1];
+
+    const double ncp_prior = std::log(73.53 * 0.01 * std::pow(N, -0.478)) - 4;
+    std::vector<double> best(N+1, 0.);
+    std::vector<std::size_t> last(N);
+    for (std::size_t k = 0; k < N; ++k) {
+        double max = -std::numeric_limits<double>::infinity();
+        std::size_t pos = 0;
+        for (std::size_t r = 0; r <= k; ++r) {
+            const double n = cumw[k+1] - cumw[r];
+            const double f = n * std::log(n/(edges[k+1] - edges[r])) + ncp_prior + best[r];
+            if (f > max) {
+                max = f;
+                pos = r;
+            }
+        }
+        best[k+1] = max;
+        last[k] = pos;
+    }
+
+    std::size_t n_cp = 0;
+    for (auto i = N; i != 0; i = last[i-1]) ++n_cp;
+    return n_cp;
+}
+
+struct timing {
+    double min, median, mean, stddev;
+};
+
+// run f warmup + reps times, statistics of the last reps runs in seconds
+timing measure(const std::function<void()>& f, int warmup, int reps) {
+    for (int i = 0; i < warmup; ++i) f();
+    std::vector<double> t;
+    for (int i = 0; i < reps; ++i) {
+        auto start = bb::clock::now();
+        f();
+        t.push_back(bb::duration_cast<bb::us>(bb::clock::now() - start).count()/1.E6);
+    }
+    std::sort(t.begin(), t.end());
+    double mean = 0, var = 0;
+    for (auto& i : t) mean += i/t.size();
+    for (auto& i : t) var += (i - mean)*(i - mean)/t.size();
+    return { t.front(), t[t.size()/2], mean, std::sqrt(var) };
+}
+
+// least squares fit of log(t) = log(a) + k log(N), returns k
+double exponent(const std::vector<std::pair<double, double>>& points) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    const double n = points.size();
+    for (auto& p : points) {
+        const double x = std::log(p.first), y = std::log(p.second);
+        sx += x; sy += y; sxx += x*x; sxy += x*y;
+    }
+    return (n*sxy - sx*sy)/(n*sxx - sx*sx);
+}
+
+int main(int argc, char** argv) {
+
+    std::string progname(argv[0]);
+
+    auto usage = [&]() {
+        std::cerr << "USAGE: " << progname << " [--reps <n> (default 5)] [--warmup <n> (default 1)]"
+                  << " [--max-n <n> (default 1000000)] [--budget <s> (default 60)] [--json <file> (default bench.json)]\n";
+    };
+
+    const char* const short_opts = "h";
+    const option long_opts[] = {
+        { "reps",   required_argument, nullptr, 1   },
+        { "warmup", required_argument, nullptr, 2   },
+        { "max-n",  required_argument, nullptr, 3   },
+        { "budget", required_argument, nullptr, 4   },
+        { "json",   required_argument, nullptr, 5   },
+        { "help",   no_argument,       nullptr, 'h' },
+        { nullptr,  no_argument,       nullptr, 0   }
+    };
+
+    // defaults
+    int reps = 5;
+    int warmup = 1;
+    std::size_t max_n = 1000000;
+    double budget = 60;
+    std::string json = "bench.json";
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, short_opts, long_opts, nullptr)) != -1) {
+        switch (opt) {
+            case 1: reps   = std::max(1, std::stoi(optarg)); break;
+            case 2: warmup = std::max(0, std::stoi(optarg)); break;
+            case 3: max_n  = std::stoul(optarg); break;
+            case 4: budget = std::stod(optarg); break;
+            case 5: json   = optarg; break;
+            case 'h':
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // engines under test, called on the sorted and merged events
+    bb::options scalar, pruned, grid, segments;
+    scalar.kernel = bb::simd::scalar;
+    pruned.pruned = true;
+    grid.grid = 1000;
+    segments.segments = std::max(2u, std::thread::hardware_concurrency());
+    segments.threads  = 0;
+
+    // results of the engines that return no vector, kept from being optimized out
+    volatile std::size_t sink = 0;
+    (void)sink;
+
+    using engine = std::function<void(const std::vector<double>&)>;
+    const std::vector<std::pair<std::string, engine>> engines = {
+        { "blocks/scalar", [&](const std::vector<double>& e) { BayesianBlocks::blocks(e, 0.01, scalar); } },
+        { "hardcoded",     [&](const std::vector<double>& e) { sink = hardcoded(e); } },
+        { "blocks",        [&](const std::vector<double>& e) { BayesianBlocks::blocks(e, 0.01); } },
+        { "blocks/pruned", [&](const std::vector<double>& e) { BayesianBlocks::blocks(e, 0.01, pruned); } },
+        { "blocks/grid",   [&](const std::vector<double>& e) { BayesianBlocks::blocks(e, 0.01, grid); } },
+        { "blocks/segments", [&](const std::vector<double>& e) { BayesianBlocks::blocks(e, 0.01, segments); } },
+        // float data: the input and its sort in half the memory, the edges
+        // stay in double precision. Values that round to the same float are
+        // merged. Binned data keeps float edges, for the float kernels
+        { "blocks/float",  [&](const std::vector<double>& e) {
+            BayesianBlocks::blocks(std::vector<float>(e.begin(), e.end()), 0.01); } },
+        { "binned/double", [&](const std::vector<double>& e) { binned<double>(e); } },
+        { "binned/float",  [&](const std::vector<double>& e) { binned<float>(e); } },
+        // histograms of about 10 events per bin
+        { "rebin",         [&](const std::vector<double>& e) {
+            const auto range = std::minmax_element(e.begin(), e.end());
+            TH1D h("h", "h", std::max<std::size_t>(e.size()/10, 1), *range.first, *range.second);
+            for (auto& i : e) h.Fill(i);
+            delete BayesianBlocks::rebin(&h, 0.01); } },
+        { "rebin_binned",  [&](const std::vector<double>& e) {
+            const auto range = std::minmax_element(e.begin(), e.end());
+            TH1D h("h", "h", std::max<std::size_t>(e.size()/10, 1), *range.first, *range.second);
+            for (auto& i : e) h.Fill(i);
+            delete BayesianBlocks::rebin_binned(&h, 0.01); } },
+        // the fitness policies: blocks and rebin run on fitness::events,
+        // rebin_binned on fitness::binned. Unit values and errors here
+        { "measurements",  [&](const std::vector<double>& e) {
+            const std::vector<double> ones(e.size(), 1.);
+            BayesianBlocks::blocks_measurements(e, ones, ones); } }
+    };
+
+    const std::vector<std::string> datasets = { "uniform", "piecewise", "duplicates" };
+
+    std::vector<std::size_t> sizes;
+    for (std::size_t N = 1000; N <= max_n; N *= 10) {
+        sizes.push_back(N);
+        if (3*N <= max_n) sizes.push_back(3*N);
+    }
+
+    std::ostringstream results, fits;
+    results << std::setprecision(9);
+    fits << std::setprecision(6);
+
+    std::cout << std::setw(12) << "dataset" << std::setw(16) << "engine" << std::setw(10) << "N"
+              << std::setw(14) << "median [s]" << std::setw(14) << "min [s]"
+              << std::setw(14) << "stddev [s]" << std::endl;
+
+    for (auto& d : datasets) {
+        for (auto& e : engines) {
+            const bool worst = worst_case(d, e.first);
+            std::vector<std::pair<double, double>> points;
+            double last_N = 0, last_t = 0;
+            for (auto N : sizes) {
+                // skip sizes that are expected to go over budget, assuming the
+                // quadratic worst case
+                if (last_t > 0 and (warmup + reps)*last_t*(N/last_N)*(N/last_N) > budget) {
+                    std::cout << std::setw(12) << d << std::setw(16) << e.first << std::setw(10) << N
+                              << (worst ? "   skipped (known worst case, quadratic)" : "   skipped (over budget)")
+                              << std::endl;
+                    if (worst) {
+                        if (results.tellp() > 0) results << ",\n";
+                        results << "    {\"dataset\": \"" << d << "\", \"engine\": \"" << e.first
+                                << "\", \"N\": " << N << ", \"skipped\": \"known worst case\"}";
+                    }
+                    continue;
+                }
+
+                std::mt19937 gen(N);
+                auto events = generate(d, N, gen);
+                auto t = measure([&]() { e.second(events); }, warmup, reps);
+
+                std::cout << std::setw(12) << d << std::setw(16) << e.first << std::setw(10) << N
+                          << std::setw(14) << t.median << std::setw(14) << t.min
+                          << std::setw(14) << t.stddev << std::endl;
+
+                if (results.tellp() > 0) results << ",\n";
+                results << "    {\"dataset\": \"" << d << "\", \"engine\": \"" << e.first
+                        << "\", \"N\": " << N << ", \"reps\": " << reps << ", \"warmup\": " << warmup
+                        << ", \"min\": " << t.min << ", \"median\": " << t.median
+                        << ", \"mean\": " << t.mean << ", \"stddev\": " << t.stddev << "}";
+
+                // very short runs are dominated by overheads, not by the scaling
+                if (t.median > 1E-3) points.emplace_back(N, t.median);
+                last_N = N;
+                last_t = t.median;
+            }
+
+            if (points.size() >= 2) {
+                const auto k = exponent(points);
+                std::cout << std::setw(12) << d << std::setw(16) << e.first
+                          << "   complexity exponent: " << k
+                          << (worst ? " (known worst case: flat data, little pruning)" : "") << std::endl;
+                if (fits.tellp() > 0) fits << ",\n";
+                fits << "    {\"dataset\": \"" << d << "\", \"engine\": \"" << e.first
+                     << "\", \"exponent\": " << k << ", \"points\": " << points.size()
+                     << ", \"worst_case\": " << (worst ? "true" : "false") << "}";
+            }
+        }
+    }
+
+    std::ofstream fout(json);
+    fout << "{\n"
+         << "  \"simd\": " << static_cast<int>(BayesianBlocks::simd_level()) << ",\n"
+         << "  \"unit\": \"s\",\n"
+         << "  \"results\": [\n" << results.str() << "\n  ],\n"
+         << "  \"exponents\": [\n" << fits.str() << "\n  ]\n"
+         << "}\n";
+    std::cout << json << " written" << std::endl;
+
+    return 0;
+}
@@ -2,21 +2,52 @@
 #include <fstream>
 #include <vector>
 #include <iterator>
+#include <random>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <unistd.h>
+#include <atomic>
+#include <new>
 
+#include "../include/bayesian_blocks.hpp"
+#include "../include/bayesian_blocks_engine.hpp"
+#include "../include/bayesian_blocks_ooc.hpp"
+#include "../include/bayesian_blocks_io.hpp"
+#include "../include/bayesian_blocks_trigger.hpp"
+#include "../include/bayesian_blocks_bootstrap.hpp"
+
+// the core tests are built with -DBAYESIAN_BLOCKS_NO_ROOT
+#ifndef BAYESIAN_BLOCKS_NO_ROOT
 #include "../include/bayesian_blocks_root.hpp"
 #include "TFile.h"
 #include "TH1D.h"
 #include "TCanvas.h"
+#include "TTree.h"
+#endif
 
 bool equal(std::vector<double> a, std::vector<double> b, double eps);
 
+// heap allocations, counted for the zero-copy interface test
+std::atomic<std::size_t> n_allocs(0);
+
+// not inlined, or gcc mistakes the pairs of new and delete for mismatched ones
+__attribute__((noinline)) void* operator new(std::size_t n) {
+    ++n_allocs;
+    if (auto p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+
 int main() {
 
     int exit_status = 0;
-    std::ifstream fin("test.dat");
-    double a;
-    std::vector<double> v;
-    while (fin >> a) v.emplace_back(a);
+    auto v = BayesianBlocks::read_text("test.dat");
 
     std::vector<double> exp = {
         -3.48528, -1.87114, -1.36282, -0.677218,
@@ -35,6 +66,7 @@ int main() {
         exit_status = 1;
     }
 
+#ifndef BAYESIAN_BLOCKS_NO_ROOT
     // testing with ROOT histogram
     TH1D h("hist", "hist", 100, -3, 10);
     for (auto& val : v) h.Fill(val);
@@ -56,6 +88,610 @@ int main() {
         std::cerr << std::endl;
         exit_status = 2;
     }
+#endif
+
+    // SIMD kernels must select the same change points as the scalar one
+    std::vector<double> synth;
+    std::mt19937 gen(42);
+    std::exponential_distribution<double> slow(1.), fast(5.);
+    double t = 0;
+    for (int i = 0; i < 10000; ++i) {
+        t += (i/1000)%2 ? slow(gen) : fast(gen);
+        synth.push_back(t);
+    }
+
+    BayesianBlocks::bb::options scalar;
+    scalar.kernel = BayesianBlocks::bb::simd::scalar;
+    auto ref_dat   = BayesianBlocks::blocks(v,     0.01, scalar);
+    auto ref_synth = BayesianBlocks::blocks(synth, 0.01, scalar);
+
+    for (auto level : {BayesianBlocks::bb::simd::avx2, BayesianBlocks::bb::simd::avx512}) {
+        if (BayesianBlocks::simd_level() < level) continue;
+        BayesianBlocks::bb::options opts;
+        opts.kernel = level;
+        if (BayesianBlocks::blocks(v,     0.01, opts) != ref_dat or
+            BayesianBlocks::blocks(synth, 0.01, opts) != ref_synth) {
+            std::cerr << "ERROR: test 3 failed: SIMD kernel "
+                      << static_cast<int>(level) << " differs from the scalar one" << std::endl;
+            exit_status = 3;
+        }
+    }
+
+    // pruned mode must find the same change points with fewer evaluations
+    BayesianBlocks::bb::options pruned;
+    BayesianBlocks::bb::stats report;
+    pruned.pruned = true;
+    pruned.report = &report;
+    if (BayesianBlocks::blocks(v,     0.01, pruned) != ref_dat or
+        BayesianBlocks::blocks(synth, 0.01, pruned) != ref_synth or
+        report.candidates >= synth.size()*(synth.size()+1)/2) {
+        std::cerr << "ERROR: test 4 failed: pruned mode differs from the exhaustive one" << std::endl;
+        exit_status = 4;
+    }
+
+    // splitting the steps among threads must not change the result
+    BayesianBlocks::bb::options threaded;
+    threaded.threads = 4;
+    threaded.parallel_threshold = 256;
+    auto par_synth = BayesianBlocks::blocks(synth, 0.01, threaded);
+    threaded.pruned = true;
+    // an exception thrown by a worker reaches the caller, the pool stays usable
+    BayesianBlocks::detail::thread_pool pool(4);
+    auto throwing = [](unsigned i) { if (i == 2) throw std::runtime_error("ERROR: worker"); };
+    bool pool_ok = false;
+    try { pool.run(throwing); }
+    catch (const std::runtime_error&) { pool_ok = true; }
+    std::atomic<unsigned> ran(0);
+    auto counting = [&ran](unsigned) { ++ran; };
+    pool.run(counting);
+    if (!pool_ok or ran != 4 or par_synth != BayesianBlocks::blocks(synth, 0.01) or
+        BayesianBlocks::blocks(synth, 0.01, threaded) != par_synth) {
+        std::cerr << "ERROR: test 5 failed: multi-threaded run differs from the serial one" << std::endl;
+        exit_status = 5;
+    }
+
+    // appending the data in chunks must give the same change points
+    BayesianBlocks::Engine engine(0.01, synth.size());
+    for (std::size_t i = 0; i < synth.size(); i += 1500) {
+        engine.append(std::vector<double>(synth.begin() + i,
+                                          synth.begin() + std::min(i + 1500, synth.size())));
+    }
+    // a rejected append leaves the engine as it was
+    BayesianBlocks::Engine failed(0.01, 5), clean(0.01, 5);
+    failed.append({1, 2, 3});
+    clean.append({1, 2, 3});
+    try {
+        failed.append({4, 4}, {1, 1});
+    }
+    catch (const std::invalid_argument&) {}
+    bool failed_ok = failed.size() == 3 and failed.change_points() == clean.change_points();
+    // as blocks(), values that are NaN or too close to be resolved are rejected
+    try {
+        failed.append({4, std::nan("")});
+        failed_ok = false;
+    }
+    catch (const std::domain_error&) {}
+    try {
+        failed.append({std::nextafter(3., 4.)});
+        failed_ok = false;
+    }
+    catch (const std::invalid_argument&) {}
+    failed_ok = failed_ok and failed.size() == 3;
+    failed.append({4, 5});
+    clean.append({4, 5});
+    failed_ok = failed_ok and failed.change_points() == clean.change_points();
+    if (!failed_ok or engine.change_points() != ref_synth) {
+        std::cerr << "ERROR: test 6 failed: incremental engine differs from blocks()" << std::endl;
+        exit_status = 6;
+    }
+
+    // other value and weight types
+    std::vector<float> vf(v.begin(), v.end());
+    auto rf = BayesianBlocks::blocks(vf, 0.01);
+    std::vector<double> rfd(rf.begin(), rf.end());
+    std::vector<double> ones(synth.size(), 1.);
+    std::vector<std::uint64_t> ones64(synth.size(), 1);
+    // adjacent floats: the midpoints are exact in double precision, adjacent
+    // doubles cannot be resolved
+    std::vector<float> close(20, 1000.f);
+    for (std::size_t i = 1; i < close.size(); ++i) close[i] = std::nextafter(close[i-1], 2000.f);
+    auto rc  = BayesianBlocks::blocks(close, 0.01);
+    auto rcd = BayesianBlocks::blocks(std::vector<double>(close.begin(), close.end()), 0.01);
+    bool close_ok = rc.size() == rcd.size() and rc.front() == close.front() and rc.back() == close.back() and
+                    std::adjacent_find(rc.begin(), rc.end(), std::greater_equal<float>()) == rc.end();
+    for (std::size_t i = 0; close_ok and i < rc.size(); ++i) close_ok = rc[i] == static_cast<float>(rcd[i]);
+    try {
+        BayesianBlocks::blocks(std::vector<double>{1., std::nextafter(1., 2.)}, 0.01);
+        close_ok = false;
+    }
+    catch (const std::invalid_argument&) {}
+    if (!close_ok or !equal(rfd, ref_dat, 1E-04) or
+        BayesianBlocks::blocks(synth, ones,   0.01) != ref_synth or
+        BayesianBlocks::blocks(synth, ones64, 0.01) != ref_synth) {
+        std::cerr << "ERROR: test 7 failed: results depend on the value or weight type" << std::endl;
+        exit_status = 7;
+    }
+
+#ifndef BAYESIAN_BLOCKS_NO_ROOT
+    // binned mode: edges taken among the input ones, contents preserved
+    auto hb = BayesianBlocks::rebin_binned(&h, 0.01);
+    std::vector<double> h_edges(101), h_counts(100);
+    for (int i = 0; i <= 100; ++i) h_edges[i] = h.GetXaxis()->GetBinLowEdge(i+1);
+    for (int i = 0; i < 100; ++i) h_counts[i] = h.GetBinContent(i+1);
+    auto rb = BayesianBlocks::blocks_binned(h_edges, h_counts, 0.01);
+    double sum = 0;
+    for (int i = 1; i <= hb->GetNbinsX(); ++i) {
+        sum += hb->GetBinContent(i) * hb->GetXaxis()->GetBinWidth(i);
+    }
+    if (hb->GetNbinsX() != static_cast<int>(rb.size()) - 1 or
+        !equal(std::vector<double>(hb->GetXaxis()->GetXbins()->GetArray(),
+                                   hb->GetXaxis()->GetXbins()->GetArray() + rb.size()), rb, 1E-09) or
+        std::abs(sum - h.Integral()) > 1E-06) {
+        std::cerr << "ERROR: test 8 failed: binned rebinning" << std::endl;
+        exit_status = 8;
+    }
+#endif
+
+    // edge cache: same results, served from disk the second time and after
+    // reopening, entries evicted when over the size limit
+    char cache_dir[] = "/tmp/bb-cache-XXXXXX";
+    if (!mkdtemp(cache_dir)) throw std::runtime_error("could not create temporary directory");
+    std::size_t hits = 0, evictions = 0;
+    bool cache_ok = true;
+    {
+        BayesianBlocks::edge_cache cache(cache_dir);
+        BayesianBlocks::bb::options cached;
+        cached.cache = &cache;
+        cache_ok = cache_ok and BayesianBlocks::blocks(synth, 0.01, cached) == ref_synth;
+        cache_ok = cache_ok and BayesianBlocks::blocks(synth, 0.01, cached) == ref_synth;
+        hits += cache.hits();
+    }
+    {
+        BayesianBlocks::edge_cache cache(cache_dir, 1);
+        BayesianBlocks::bb::options cached;
+        cached.cache = &cache;
+        cache_ok = cache_ok and BayesianBlocks::blocks(synth, 0.01, cached) == ref_synth;
+        cache_ok = cache_ok and BayesianBlocks::blocks(v, 0.01, cached) == ref_dat;
+        hits += cache.hits();
+        evictions = cache.evictions();
+        cache_ok = cache_ok and cache.entries() == 0;
+    }
+    // binned data on the cells of event data is a distinct entry
+    {
+        BayesianBlocks::edge_cache cache(cache_dir);
+        BayesianBlocks::bb::options cached;
+        cached.cache = &cache;
+        std::vector<double> unit, unit_edges(1, 0.), unit_counts(100, 1.);
+        for (int i = 0; i < 100; ++i) unit.push_back(i);
+        for (int i = 1; i < 100; ++i) unit_edges.push_back(i - 0.5);
+        unit_edges.push_back(99);
+        BayesianBlocks::blocks(unit, 0.01, cached);
+        BayesianBlocks::blocks_binned(unit_edges, unit_counts, 0.01, cached);
+        cache_ok = cache_ok and cache.hits() == 0 and cache.entries() == 2;
+    }
+    {
+        // evict the entries left
+        BayesianBlocks::edge_cache cache(cache_dir, 1);
+        cache.store(0, 1, std::vector<std::size_t>{ 0, 1 });
+    }
+    std::remove((std::string(cache_dir) + "/index.bbi").c_str());
+    rmdir(cache_dir);
+    if (!cache_ok or hits != 2 or evictions != 2) {
+        std::cerr << "ERROR: test 9 failed: edge cache" << std::endl;
+        exit_status = 9;
+    }
+
+    // observer: phases in order, throttled progress, cancellation and time budget
+    namespace bb = BayesianBlocks::bb;
+    struct recorder : public bb::observer {
+        std::vector<bb::phase> phases;
+        std::size_t calls = 0, candidates = 0, stop_at = 0;
+        void on_phase(bb::phase p, double) override { phases.push_back(p); }
+        void on_progress(std::size_t k, std::size_t) override {
+            ++calls;
+            if (stop_at > 0 and k >= stop_at) this->cancel();
+        }
+        void on_report(const bb::stats& r) override { candidates = r.candidates; }
+    } rec;
+    bb::options observed;
+    observed.observer = &rec;
+    bool observer_ok = BayesianBlocks::blocks(synth, 0.01, observed) == ref_synth and
+        rec.phases == std::vector<bb::phase>{ bb::phase::sort, bb::phase::edges,
+                                              bb::phase::loop, bb::phase::backtrack } and
+        rec.calls == (synth.size() + rec.progress_interval - 1)/rec.progress_interval and
+        rec.candidates == synth.size()*(synth.size()+1)/2;
+    for (int i = 0; i < 2; ++i) {
+        rec.stop_at = i == 0 ? synth.size()/2 : 0;
+        rec.budget  = i == 0 ? 0 : 1E-9;
+        try {
+            BayesianBlocks::blocks(synth, 0.01, observed);
+            observer_ok = false;
+        }
+        catch (const bb::cancelled&) {}
+    }
+    // the legacy flags keep the caller's observer
+    rec.stop_at = synth.size()/2;
+    rec.budget  = 0;
+    try {
+        BayesianBlocks::blocks(synth, 0.01, observed, false, true);
+        observer_ok = false;
+    }
+    catch (const bb::cancelled&) {}
+    // the steps of a cancelled append are done by the next query
+    BayesianBlocks::Engine cancelled_engine(0.01, synth.size(), observed);
+    try {
+        cancelled_engine.append(synth);
+        observer_ok = false;
+    }
+    catch (const bb::cancelled&) {}
+    rec.stop_at = 0;
+    observer_ok = observer_ok and cancelled_engine.change_points() == ref_synth;
+    // an interval of 0 checks at every step
+    rec.progress_interval = 0;
+    rec.calls = 0;
+    observer_ok = observer_ok and BayesianBlocks::blocks(synth, 0.01, observed) == ref_synth and
+                  rec.calls == synth.size() and
+                  BayesianBlocks::blocks_scan(synth, {0.01}, observed).front() == ref_synth;
+    rec.progress_interval = 4096;
+    if (!observer_ok) {
+        std::cerr << "ERROR: test 10 failed: observer" << std::endl;
+        exit_status = 10;
+    }
+
+    // out-of-core mode, on a file of sorted values, in memory and with scratch files
+    auto write_dat = [](std::vector<double> values, const char* name) {
+        std::sort(values.begin(), values.end());
+        std::ofstream fout(name, std::ios::binary);
+        fout.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(double));
+    };
+    write_dat(v,     "test-ooc-v.bin");
+    write_dat(synth, "test-ooc-synth.bin");
+    bool ooc_ok = BayesianBlocks::blocks_mmap("test-ooc-v.bin", 0.01) == ref_dat and
+                  BayesianBlocks::blocks_mmap("test-ooc-synth.bin", 0.01) == ref_synth and
+                  BayesianBlocks::blocks_mmap("test-ooc-synth.bin", 0.01, pruned, ".") == ref_synth;
+    {
+        std::ofstream fout("test-ooc-unsorted.bin", std::ios::binary);
+        fout.write(reinterpret_cast<const char*>(v.data()), v.size()*sizeof(double));
+    }
+    try {
+        BayesianBlocks::blocks_mmap("test-ooc-unsorted.bin", 0.01);
+        ooc_ok = false;
+    }
+    catch (const std::invalid_argument&) {}
+    for (auto f : {"test-ooc-v.bin", "test-ooc-synth.bin", "test-ooc-unsorted.bin"}) std::remove(f);
+    if (!ooc_ok) {
+        std::cerr << "ERROR: test 11 failed: out-of-core mode" << std::endl;
+        exit_status = 11;
+    }
+
+    // ingest: radix sort, serial and parallel, same order as std::sort. Input
+    // with negative values, signed zeros and duplicates
+    std::vector<double> many(1 << 20);
+    std::uniform_real_distribution<double> uniform(-1E3, 1E3);
+    for (auto& i : many) i = std::round(uniform(gen)*100)/100;
+    many[0] = -0.;
+    auto sorted = many;
+    std::sort(sorted.begin(), sorted.end());
+    auto radix = many, radix_par = many;
+    BayesianBlocks::detail::sort(radix.data(),     static_cast<int*>(nullptr), radix.size(), 1);
+    BayesianBlocks::detail::sort(radix_par.data(), static_cast<int*>(nullptr), radix.size(), 4);
+    std::vector<float> many_f(many.begin(), many.end()), sorted_f(many_f);
+    std::sort(sorted_f.begin(), sorted_f.end());
+    BayesianBlocks::detail::sort(many_f.data(), static_cast<int*>(nullptr), many_f.size(), 1);
+    // a caller's guarantee that the input is sorted is checked
+    bb::options presorted;
+    presorted.presorted = true;
+    std::vector<double> v_sorted(v);
+    std::sort(v_sorted.begin(), v_sorted.end());
+    bool ingest_ok = radix == sorted and radix_par == sorted and many_f == sorted_f and
+                     BayesianBlocks::blocks(v_sorted, 0.01, presorted) == ref_dat;
+    try {
+        BayesianBlocks::blocks(many, 0.01, presorted);
+        ingest_ok = false;
+    }
+    catch (const std::invalid_argument&) {}
+    if (!ingest_ok) {
+        std::cerr << "ERROR: test 12 failed: ingest" << std::endl;
+        exit_status = 12;
+    }
+
+    // zero-copy interface: same results from pointer ranges, with and without
+    // weights, and no allocation once the workspace has grown. The pruned
+    // mode keeps its candidates in the workspace too
+    bb::workspace<double> ws;
+    const auto ref_ones = BayesianBlocks::blocks(synth, ones, 0.01);
+    bool span_ok = BayesianBlocks::blocks(synth.data(), synth.data() + synth.size(), 0.01, ws) == ref_synth and
+                   BayesianBlocks::blocks(synth.begin(), synth.end(), ones64.begin(), 0.01, ws) == ref_ones and
+                   BayesianBlocks::blocks(v.begin(), v.end(), 0.01, ws, pruned) == ref_dat;
+    auto allocs = n_allocs.load();
+    for (int i = 0; i < 3; ++i) {
+        BayesianBlocks::blocks(synth.data(), synth.data() + synth.size(), 0.01, ws);
+        BayesianBlocks::blocks(synth.data(), synth.data() + synth.size(), ones.data(), 0.01, ws, pruned);
+        BayesianBlocks::blocks(v.data(), v.data() + v.size(), 0.01, ws);
+        // the first round may still grow the workspace
+        if (i == 0) allocs = n_allocs.load();
+    }
+    if (!span_ok or n_allocs != allocs) {
+        std::cerr << "ERROR: test 13 failed: zero-copy interface ("
+                  << n_allocs - allocs << " allocations)" << std::endl;
+        exit_status = 13;
+    }
+
+    // point measurements: steps in the mean of a Gaussian series are found,
+    // with every kernel and with pruning
+    std::vector<double> t_meas, y_meas, sigma_meas;
+    std::normal_distribution<double> noise(0, 0.2);
+    for (int i = 0; i < 3000; ++i) {
+        t_meas.push_back(i);
+        y_meas.push_back((i < 1000 ? 1. : i < 2000 ? 1.5 : 0.8) + noise(gen));
+        sigma_meas.push_back(0.2);
+    }
+    const std::vector<double> exp_meas = { 0, 999.5, 1999.5, 2999 };
+    bool meas_ok = BayesianBlocks::blocks_measurements(t_meas, y_meas, sigma_meas) == exp_meas and
+                   BayesianBlocks::blocks_measurements(t_meas, y_meas, sigma_meas, 0.01, pruned) == exp_meas;
+    for (auto k : { bb::simd::scalar, bb::simd::avx2, bb::simd::avx512 }) {
+        bb::options opts;
+        opts.kernel = k;
+        meas_ok = meas_ok and BayesianBlocks::blocks_measurements(t_meas, y_meas, sigma_meas, 0.01, opts) == exp_meas;
+    }
+    if (!meas_ok) {
+        std::cerr << "ERROR: test 14 failed: point measurements" << std::endl;
+        exit_status = 14;
+    }
+
+    // approximate modes: a grid as fine as the data and blocks as long as the
+    // data are exact, coarser ones report their gap to the exact objective
+    bb::stats exact_report, approx_report;
+    bb::options exact_opts, fine, grid, band;
+    exact_opts.report = &exact_report;
+    BayesianBlocks::blocks(synth, 0.01, exact_opts);
+    fine.grid = fine.max_block = synth.size();
+    bool approx_ok = BayesianBlocks::blocks(synth, 0.01, fine) == ref_synth;
+    grid.grid = synth.size()/50;
+    band.max_block = 300;
+    band.pruned = true;
+    for (auto o : { grid, band }) {
+        o.exact_gap = true;
+        o.report = &approx_report;
+        BayesianBlocks::blocks(synth, 0.01, o);
+        approx_ok = approx_ok and approx_report.gap >= 0 and
+                    std::abs(approx_report.objective + approx_report.gap - exact_report.objective) <
+                    1E-9 * std::abs(exact_report.objective);
+    }
+    if (!approx_ok) {
+        std::cerr << "ERROR: test 15 failed: approximate modes" << std::endl;
+        exit_status = 15;
+    }
+
+    // prior scan: the same change points as one call per prior, exhaustive,
+    // pruned, threaded and on a grid
+    const std::vector<double> ps = { 0.5, 0.05, 0.01, 1E-4 };
+    bb::options parallel;
+    parallel.threads = 4;
+    parallel.parallel_threshold = 64;
+    bool scan_ok = true;
+    for (auto o : { bb::options(), pruned, parallel, threaded, grid }) {
+        const auto scan = BayesianBlocks::blocks_scan(synth, ps, o);
+        const auto scan_w = BayesianBlocks::blocks_scan(synth, ones, ps, o);
+        scan_ok = scan_ok and scan.size() == ps.size() and scan_w.size() == ps.size();
+        for (std::size_t j = 0; scan_ok and j < ps.size(); ++j) {
+            scan_ok = scan[j] == BayesianBlocks::blocks(synth, ps[j], o) and
+                      scan_w[j] == BayesianBlocks::blocks(synth, ones, ps[j], o);
+        }
+    }
+#ifndef BAYESIAN_BLOCKS_NO_ROOT
+    // and for histograms, unbinned and binned
+    auto hist_edges = [](TH1* hist) {
+        auto a = hist->GetXaxis()->GetXbins()->GetArray();
+        return std::vector<double>(a, a + hist->GetNbinsX()+1);
+    };
+    for (bool binned : { false, true }) {
+        auto hs = binned ? BayesianBlocks::rebin_binned_scan(&h, ps) : BayesianBlocks::rebin_scan(&h, ps);
+        for (std::size_t j = 0; j < ps.size(); ++j) {
+            auto ref = binned ? BayesianBlocks::rebin_binned(&h, ps[j]) : BayesianBlocks::rebin(&h, ps[j]);
+            scan_ok = scan_ok and hist_edges(hs[j]) == hist_edges(ref);
+            delete ref;
+            delete hs[j];
+        }
+    }
+    // close priors get distinct names
+    auto hs_close = BayesianBlocks::rebin_scan(&h, { 0.01, 0.01000001 });
+    scan_ok = scan_ok and std::string(hs_close[0]->GetName()) == "hist_b_p0.01" and
+              std::string(hs_close[1]->GetName()) == "hist_b_p0.01000001";
+    for (auto hist : hs_close) delete hist;
+#endif
+    if (!scan_ok) {
+        std::cerr << "ERROR: test 16 failed: prior scan" << std::endl;
+        exit_status = 16;
+    }
+
+    // segment-parallel solver: the same result as the serial one, whether
+    // or not the boundaries converged within their segments
+    bb::stats seg_report;
+    bb::options segmented;
+    segmented.report = &seg_report;
+    segmented.segments = 4;
+    bool seg_ok = BayesianBlocks::blocks(synth, 0.01, segmented) == ref_synth and seg_report.certified and
+                  std::abs(seg_report.objective - exact_report.objective) < 1E-9 * std::abs(exact_report.objective);
+    segmented.segments = 64;
+    const auto seg_many = BayesianBlocks::blocks(synth, 0.01, segmented);
+    seg_ok = seg_ok and seg_many == ref_synth;
+    // more segments than threads: each thread takes several, the result
+    // does not depend on their number
+    segmented.segments = 8;
+    const auto seg_serial = BayesianBlocks::blocks(synth, 0.01, segmented);
+    const auto seg_certified = seg_report.certified;
+    segmented.threads = 3;
+    seg_ok = seg_ok and seg_serial == ref_synth and BayesianBlocks::blocks(synth, 0.01, segmented) == seg_serial and
+             seg_report.certified == seg_certified;
+    // flat data: the change points never settle near the boundaries, no
+    // artefact must be left there
+    std::vector<double> flat;
+    std::uniform_real_distribution<double> unif(0., 1.);
+    for (int i = 0; i < 20000; ++i) flat.push_back(unif(gen));
+    const auto ref_flat = BayesianBlocks::blocks(flat, 0.01);
+    for (std::size_t s : {4, 7}) {
+        bb::options o;
+        o.segments = s;
+        o.threads = 2;
+        seg_ok = seg_ok and BayesianBlocks::blocks(flat, 0.01, o) == ref_flat;
+    }
+    // approximate modes are never certified
+    segmented.grid = 100;
+    BayesianBlocks::blocks(synth, 0.01, segmented);
+    seg_ok = seg_ok and !seg_report.certified;
+    if (!seg_ok) {
+        std::cerr << "ERROR: test 17 failed: segment-parallel solver" << std::endl;
+        exit_status = 17;
+    }
+
+    // unbinned events from a tree, and from chunks filled by threads: the
+    // same blocks as the whole input, all the events in the histogram
+    std::vector<std::vector<double>> chunks(3);
+    for (std::size_t i = 0; i < synth.size(); ++i) chunks[(i * 7) % 3].push_back(synth[i]);
+    bool tree_ok = BayesianBlocks::blocks_chunks(chunks, 0.01, parallel) == ref_synth;
+#ifndef BAYESIAN_BLOCKS_NO_ROOT
+    {
+        TFile f_tree("test-tree.root", "recreate");
+        TTree tree("events", "events");
+        double energy;
+        tree.Branch("energy", &energy);
+        for (auto val : synth) {
+            energy = val;
+            tree.Fill();
+        }
+        tree.Write();
+    }
+    auto ht = BayesianBlocks::blocks_tree("test-tree.root", "events", "energy", 0.01, parallel);
+    double events = 0;
+    for (int i = 1; i <= ht->GetNbinsX(); ++i) events += ht->GetBinContent(i) * ht->GetXaxis()->GetBinWidth(i);
+    tree_ok = tree_ok and hist_edges(ht) == ref_synth and std::abs(events - synth.size()) < 1E-6;
+    delete ht;
+    std::remove("test-tree.root");
+#endif
+    if (!tree_ok) {
+        std::cerr << "ERROR: test 18 failed: unbinned events from a tree" << std::endl;
+        exit_status = 18;
+    }
+
+    // readers of the core build: text with a header, comments, several
+    // separators and number formats, the same values as strtod; raw float64
+    // files read in place
+    {
+        std::FILE* f = std::fopen("test-io.csv", "w");
+        std::fprintf(f, "energy, weight\n# a comment\n\n");
+        for (std::size_t i = 0; i < 1000; ++i) std::fprintf(f, "%.17g,%zu\n", synth[i] - 50, i % 3 + 1);
+        std::fprintf(f, "  1e-3 ;2\n+2.5\t1\n.5,1\n7.,1\n-0 , 1\n1.5E+2,4\n123456789012345678901234,1\n");
+        std::fprintf(f, "0.000000000000000000000000000123,1\n2.2250738585072014e-308,1\n0.1,1");
+        std::fclose(f);
+    }
+    bb::array io_w;
+    auto io_x = BayesianBlocks::read_text("test-io.csv", 0, 1, io_w);
+    bool io_ok = io_x.size() == 1010 and io_w.size() == 1010;
+    for (std::size_t i = 0; io_ok and i < 1000; ++i) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.17g", synth[i] - 50);
+        io_ok = io_x[i] == std::strtod(buf, nullptr) and io_w[i] == i % 3 + 1;
+    }
+    const bb::array io_tail = { 1e-3, 2.5, .5, 7., -0., 1.5E+2, 123456789012345678901234.,
+                                0.000000000000000000000000000123, 2.2250738585072014e-308, 0.1 };
+    io_ok = io_ok and std::equal(io_tail.begin(), io_tail.end(), io_x.begin() + 1000) and
+            std::signbit(io_x[1004]) and io_w[1000] == 2 and io_w[1005] == 4;
+    // a malformed record past the header is an error
+    {
+        std::FILE* f = std::fopen("test-io.csv", "a");
+        std::fprintf(f, "\n1.0x,1\n");
+        std::fclose(f);
+    }
+    try {
+        BayesianBlocks::read_text("test-io.csv");
+        io_ok = false;
+    }
+    catch (const std::runtime_error& e) {
+        io_ok = io_ok and std::string(e.what()).find(":1014:") != std::string::npos;
+    }
+    std::remove("test-io.csv");
+    {
+        std::FILE* f = std::fopen("test-io.bin", "wb");
+        std::fwrite(v.data(), sizeof(double), v.size(), f);
+        std::fclose(f);
+    }
+    {
+        BayesianBlocks::bb::raw_input raw("test-io.bin");
+        io_ok = io_ok and raw.size() == v.size() and std::equal(raw.begin(), raw.end(), v.begin()) and
+                BayesianBlocks::blocks(raw.begin(), raw.end(), 0.01, ws) == ref_dat;
+    }
+    std::remove("test-io.bin");
+    // lists of numbers, e.g. priors on the command line
+    io_ok = io_ok and BayesianBlocks::parse_list("0.1, 0.01,1e-3") == bb::array({ 0.1, 0.01, 1e-3 });
+    for (auto list : { "", "0.1,,0.01", "0.1,", "0.1,x" }) {
+        try {
+            BayesianBlocks::parse_list(list);
+            io_ok = false;
+        }
+        catch (const std::invalid_argument&) {}
+    }
+    if (!io_ok) {
+        std::cerr << "ERROR: test 19 failed: readers" << std::endl;
+        exit_status = 19;
+    }
+
+    // trigger: with an unbounded window the confirmed change points and the
+    // flushed ones are those of blocks(), one event at a time or in batches.
+    // A small window with a short latency stays bounded and, on this data,
+    // finds the same change points
+    const std::vector<double> ref_cp(ref_synth.begin() + 1, ref_synth.end() - 1);
+    auto triggered = [&](BayesianBlocks::Trigger& trigger, bool batch, std::size_t& max_size) {
+        std::vector<double> cps;
+        bb::change_point cp;
+        max_size = 0;
+        if (batch) trigger.push(synth.begin(), synth.end());
+        for (std::size_t i = 0; !batch and i < synth.size(); ++i) {
+            trigger.push(synth[i]);
+            max_size = std::max(max_size, trigger.size());
+            while (trigger.poll(cp)) cps.push_back(cp.time);
+        }
+        trigger.flush();
+        while (trigger.poll(cp)) cps.push_back(cp.time);
+        return cps;
+    };
+    std::size_t max_size = 0;
+    BayesianBlocks::Trigger trigger(0.01, synth.size(), synth.size());
+    bool trigger_ok = triggered(trigger, false, max_size) == ref_cp and
+                      triggered(trigger, true, max_size) == ref_cp;
+    BayesianBlocks::Trigger bounded(0.01, synth.size(), 500, 20.);
+    trigger_ok = trigger_ok and triggered(bounded, false, max_size) == ref_cp and max_size <= 500;
+    if (!trigger_ok) {
+        std::cerr << "ERROR: test 20 failed: trigger" << std::endl;
+        exit_status = 20;
+    }
+
+    // resampling: a jackknife replica has the change points of blocks() on
+    // the values left, the bootstrap does not depend on the threads and its
+    // distributions add up
+    auto jack = BayesianBlocks::blocks_jackknife(synth, 0.01, 4, pruned);
+    bool replicas_ok = jack.nominal == ref_synth and jack.change_points.size() == 4;
+    for (std::size_t g = 0; replicas_ok and g < 4; ++g) {
+        std::vector<double> left;
+        for (std::size_t i = 0; i < synth.size(); ++i) if (i % 4 != g) left.push_back(synth[i]);
+        replicas_ok = jack.change_points[g] == BayesianBlocks::blocks(left, 0.01, pruned);
+    }
+    BayesianBlocks::bb::options boot_opts = pruned;
+    boot_opts.report = nullptr;
+    auto boot = BayesianBlocks::blocks_bootstrap(synth, 0.01, 16, boot_opts, 7);
+    boot_opts.threads = 3;
+    replicas_ok = replicas_ok and BayesianBlocks::blocks_bootstrap(synth, 0.01, 16, boot_opts, 7).change_points ==
+                                  boot.change_points;
+    std::size_t n_cps = 0, n_counted = 0, n_replicas = 0;
+    for (const auto& cps : boot.change_points) n_cps += cps.size() - 2;
+    for (auto c : boot.counts) n_counted += c;
+    for (auto c : boot.n_blocks) n_replicas += c;
+    replicas_ok = replicas_ok and n_cps == n_counted and n_replicas == 16 and
+                  boot.change_points[0] != boot.change_points[1];
+    if (!replicas_ok) {
+        std::cerr << "ERROR: test 21 failed: bootstrap and jackknife" << std::endl;
+        exit_status = 21;
+    }
 
     return exit_status;
 }